@@ -34,6 +34,7 @@ private:
     MagicLineEdit *editGameRoot;
     MagicLineEdit *editOutputRoot;
     QComboBox *boxRecomImageFormat;
+    QComboBox *boxPNGProfile;
     QRadioButton *optionExportPlain;
     QRadioButton *optionExportTXDName;
     QRadioButton *optionExportFolders;
@@ -12,6 +12,10 @@ struct compressionManager abstract
 
     virtual compressionProvider*    CreateProvider( void ) = 0;
     virtual void                    DestroyProvider( compressionProvider *prov ) = 0;
+
+    // Optional stream that decompresses while it is being read. It takes over the compressed stream.
+    // Formats that cannot do that are decompressed into a temporary file instead.
+    virtual CFile*      OpenDecompressionStream( CFile *compressed )    { return nullptr; }
 };
 
 // API to decode possibly compressed streams.
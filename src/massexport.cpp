@@ -51,6 +51,19 @@ struct massexportEnv : public magicSerializationProvider
         massexportBlock.readStruct( cfgStruct );
 
         this->config.outputType = cfgStruct.outputType;
+
+        // Configurations of older versions do not store the PNG profile.
+        try
+        {
+            endian::little_endian <rw::ePNGEncodeProfile> pngProfile;
+            massexportBlock.readStruct( pngProfile );
+
+            this->config.pngProfile = pngProfile;
+        }
+        catch( rw::RwException& )
+        {
+            this->config.pngProfile = rw::PNGENCODE_FAST;
+        }
     }
 
     void Save( const MainWindow *mainWnd, rw::BlockProvider& massexportBlock ) const override
@@ -63,6 +76,9 @@ struct massexportEnv : public magicSerializationProvider
         cfgStruct.outputType = this->config.outputType;
 
         massexportBlock.writeStruct( cfgStruct );
+
+        endian::little_endian <rw::ePNGEncodeProfile> pngProfile = this->config.pngProfile;
+        massexportBlock.writeStruct( pngProfile );
     }
 
     MassExportModule::run_config config;
@@ -156,6 +172,36 @@ MassExportWindow::MassExportWindow( MainWindow *mainWnd ) : QDialog( mainWnd )
 
     imgFormatGroup->addWidget( boxRecomImageFormat );
 
+    // PNG files can be written faster if we do not care about the smallest size.
+    imgFormatGroup->addWidget( CreateLabelL( "Tools.MassExp.PngProf" ) );
+
+    QComboBox *boxPNGProfile = new QComboBox();
+
+    boxPNGProfile->addItem( "FAST" );
+    boxPNGProfile->addItem( "BALANCED" );
+    boxPNGProfile->addItem( "SMALLEST" );
+
+    {
+        rw::ePNGEncodeProfile pngProfile = env->config.pngProfile;
+
+        if ( pngProfile == rw::PNGENCODE_FAST )
+        {
+            boxPNGProfile->setCurrentText( "FAST" );
+        }
+        else if ( pngProfile == rw::PNGENCODE_BALANCED )
+        {
+            boxPNGProfile->setCurrentText( "BALANCED" );
+        }
+        else if ( pngProfile == rw::PNGENCODE_SMALLEST )
+        {
+            boxPNGProfile->setCurrentText( "SMALLEST" );
+        }
+    }
+
+    this->boxPNGProfile = boxPNGProfile;
+
+    imgFormatGroup->addWidget( boxPNGProfile );
+
     layout.top->addLayout( imgFormatGroup );
 
     // Textures can be extracted in multiple modes, depending on how the user likes it best.
@@ -346,6 +392,22 @@ void MassExportWindow::serialize( void )
     }
 
     env->config.outputType = outputType;
+
+    rw::ePNGEncodeProfile pngProfile = rw::PNGENCODE_FAST;
+    {
+        QString profileText = this->boxPNGProfile->currentText();
+
+        if ( profileText == "BALANCED" )
+        {
+            pngProfile = rw::PNGENCODE_BALANCED;
+        }
+        else if ( profileText == "SMALLEST" )
+        {
+            pngProfile = rw::PNGENCODE_SMALLEST;
+        }
+    }
+
+    env->config.pngProfile = pngProfile;
 }
 
 void InitializeMassExportToolEnvironment( void )
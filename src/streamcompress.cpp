@@ -50,6 +50,9 @@ struct streamCompressionEnv
 
 static PluginDependantStructRegister <streamCompressionEnv, mainWindowFactory_t> streamCompressionEnvRegister;
 
+// Bytes at the start of a stream that the compression managers can check their magic in.
+static const size_t STREAM_HEADER_PEEK_SIZE = 16;
+
 struct CTemporaryFile : public CFile
 {
     AINLINE CTemporaryFile( CFileTranslator *sourceTrans, CFile *wrapped )
@@ -160,40 +163,56 @@ CFile* CreateDecompressedStream( MainWindow *mainWnd, CFile *compressed )
 
     if ( streamCompressionEnv *env = streamCompressionEnvRegister.GetPluginStruct( mainWnd ) )
     {
-        bool needsStreamReset = false;
-
         compressionManager *theManager = nullptr;
 
-        for ( compressionManager *manager : env->compressors )
-        {
-            if ( needsStreamReset )
-            {
-                compressed->Seek( 0, SEEK_SET );
+        // Read the header only once and let every manager look at it, instead of reading
+        // and rewinding the real stream for each of them.
+        char headerBuf[ STREAM_HEADER_PEEK_SIZE ];
 
-                needsStreamReset = false;
-            }
+        size_t headerSize = compressed->Read( headerBuf, sizeof( headerBuf ) );
 
-            bool isCorrectFormat = manager->IsStreamCompressed( compressed );
+        compressed->Seek( 0, SEEK_SET );
 
-            needsStreamReset = true;
+        CFile *headerStream = mainWnd->fileSystem->CreateUserBufferFile( headerBuf, headerSize );
 
-            if ( isCorrectFormat )
+        if ( headerStream )
+        {
+            try
             {
-                theManager = manager;
-                break;
+                for ( compressionManager *manager : env->compressors )
+                {
+                    headerStream->Seek( 0, SEEK_SET );
+
+                    if ( manager->IsStreamCompressed( headerStream ) )
+                    {
+                        theManager = manager;
+                        break;
+                    }
+                }
             }
-        }
+            catch( ... )
+            {
+                delete headerStream;
 
-        if ( needsStreamReset )
-        {
-            compressed->Seek( 0, SEEK_SET );
+                throw;
+            }
 
-            needsStreamReset = false;
+            delete headerStream;
         }
 
         // If we found a compressed format...
         if ( theManager )
         {
+            // Formats that can be read while they are decompressed need no temporary file.
+            CFile *decStream = theManager->OpenDecompressionStream( compressed );
+
+            if ( decStream )
+            {
+                return decStream;
+            }
+
+            compressed->Seek( 0, SEEK_SET );
+
             // ... we want to create a random file and decompress into it.
             CFileTranslator *repo = env->GetRepository( mainWnd );
 
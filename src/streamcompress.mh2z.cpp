@@ -42,6 +42,33 @@ struct mh2zCompressionEnv : public compressionManager
         return true;
     }
 
+    CFile* OpenDecompressionStream( CFile *compressed ) override
+    {
+        mh2zHeader header;
+
+        if ( !compressed->ReadStruct( header ) )
+        {
+            return nullptr;
+        }
+
+        if ( header.magic[0] != 'Z' || header.magic[1] != '2' || header.magic[2] != 'H' || header.magic[3] != 'M' )
+        {
+            return nullptr;
+        }
+
+        // Since the header tells us the decompressed size, the TXD parser can read while we inflate.
+        size_t dataSize = (size_t)( compressed->GetSizeNative() - compressed->TellNative() );
+
+        try
+        {
+            return fileSystem->CreateZLIBDecompressionStream( compressed, dataSize, (fsOffsetNumber_t)header.decomp_size, true, true );
+        }
+        catch( FileSystem::filesystem_exception& )
+        {
+            return nullptr;
+        }
+    }
+
     struct mh2zCompressionProvider final : public compressionProvider
     {
         bool Compress( CFile *input, CFile *output ) override
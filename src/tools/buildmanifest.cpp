@@ -0,0 +1,359 @@
+#include "mainwindow.h"
+
+#include "buildmanifest.h"
+
+static const rw::uint32 MANIFEST_MAGIC = 0x464D424D;    // "MBMF"
+static const rw::uint32 MANIFEST_VERSION = 2;
+
+// Sanity limit for reading strings, so that a damaged manifest cannot make us allocate forever.
+static const rw::uint32 MANIFEST_MAX_STRING_LENGTH = 0x10000;
+
+template <typename numberType>
+static inline bool ReadManifestNumber( CFile *stream, numberType& valueOut )
+{
+    endian::little_endian <numberType> value;
+
+    if ( !stream->ReadStruct( value ) )
+    {
+        return false;
+    }
+
+    valueOut = value;
+    return true;
+}
+
+template <typename numberType>
+static inline void WriteManifestNumber( CFile *stream, numberType value )
+{
+    endian::little_endian <numberType> leValue = value;
+
+    stream->WriteStruct( leValue );
+}
+
+template <typename charType>
+static inline bool ReadManifestString( CFile *stream, std::basic_string <charType>& strOut )
+{
+    rw::uint32 length;
+
+    if ( !ReadManifestNumber( stream, length ) || length > MANIFEST_MAX_STRING_LENGTH )
+    {
+        return false;
+    }
+
+    strOut.resize( length );
+
+    for ( rw::uint32 n = 0; n < length; n++ )
+    {
+        // Characters are stored with 32bit so that the file does not depend on the size of wchar_t.
+        rw::uint32 ucp;
+
+        if ( !ReadManifestNumber( stream, ucp ) )
+        {
+            return false;
+        }
+
+        strOut[ n ] = (charType)ucp;
+    }
+
+    return true;
+}
+
+template <typename charType>
+static inline void WriteManifestString( CFile *stream, const std::basic_string <charType>& str )
+{
+    WriteManifestNumber( stream, (rw::uint32)str.size() );
+
+    for ( charType c : str )
+    {
+        WriteManifestNumber( stream, (rw::uint32)c );
+    }
+}
+
+bool BuildManifest::Load( CFileTranslator *root, const filePath& path )
+{
+    CFile *manifestStream = root->Open( path, "rb" );
+
+    if ( manifestStream == nullptr )
+    {
+        return false;
+    }
+
+    std::map <std::wstring, buildManifestEntry> loadedEntries;
+
+    bool isValid = false;
+
+    try
+    {
+        rw::uint32 magic, version, entryCount;
+
+        if ( ReadManifestNumber( manifestStream, magic ) && magic == MANIFEST_MAGIC &&
+             ReadManifestNumber( manifestStream, version ) && version == MANIFEST_VERSION &&
+             ReadManifestNumber( manifestStream, entryCount ) )
+        {
+            isValid = true;
+
+            for ( rw::uint32 n = 0; n < entryCount; n++ )
+            {
+                std::wstring outputPath;
+                buildManifestEntry entry;
+
+                rw::uint32 inputCount;
+
+                if ( !ReadManifestString( manifestStream, outputPath ) ||
+                     !ReadManifestString( manifestStream, entry.settings ) ||
+                     !ReadManifestNumber( manifestStream, inputCount ) )
+                {
+                    isValid = false;
+                    break;
+                }
+
+                for ( rw::uint32 i = 0; i < inputCount; i++ )
+                {
+                    buildInputFile inputFile;
+
+                    if ( !ReadManifestString( manifestStream, inputFile.relPath ) ||
+                         !ReadManifestNumber( manifestStream, inputFile.fileSize ) ||
+                         !ReadManifestNumber( manifestStream, inputFile.modTime ) ||
+                         !ReadManifestNumber( manifestStream, inputFile.contentHash ) )
+                    {
+                        isValid = false;
+                        break;
+                    }
+
+                    entry.inputs.push_back( std::move( inputFile ) );
+                }
+
+                if ( !isValid )
+                    break;
+
+                loadedEntries[ std::move( outputPath ) ] = std::move( entry );
+            }
+        }
+    }
+    catch( ... )
+    {
+        delete manifestStream;
+
+        throw;
+    }
+
+    delete manifestStream;
+
+    if ( !isValid )
+    {
+        // Everything will be built again.
+        return false;
+    }
+
+    std::unique_lock <std::mutex> ctxLoad( this->lock );
+
+    this->entries = std::move( loadedEntries );
+
+    return true;
+}
+
+bool BuildManifest::Save( CFileTranslator *root, const filePath& path ) const
+{
+    // Write into a temporary file first so that a cancelled save does not lose the old manifest.
+    filePath tmpPath = path + ".tmp";
+
+    CFile *manifestStream = root->Open( tmpPath, "wb" );
+
+    if ( manifestStream == nullptr )
+    {
+        return false;
+    }
+
+    try
+    {
+        std::unique_lock <std::mutex> ctxSave( this->lock );
+
+        WriteManifestNumber( manifestStream, MANIFEST_MAGIC );
+        WriteManifestNumber( manifestStream, MANIFEST_VERSION );
+        WriteManifestNumber( manifestStream, (rw::uint32)this->entries.size() );
+
+        for ( const auto& entryPair : this->entries )
+        {
+            const buildManifestEntry& entry = entryPair.second;
+
+            WriteManifestString( manifestStream, entryPair.first );
+            WriteManifestString( manifestStream, entry.settings );
+            WriteManifestNumber( manifestStream, (rw::uint32)entry.inputs.size() );
+
+            for ( const buildInputFile& inputFile : entry.inputs )
+            {
+                WriteManifestString( manifestStream, inputFile.relPath );
+                WriteManifestNumber( manifestStream, inputFile.fileSize );
+                WriteManifestNumber( manifestStream, inputFile.modTime );
+                WriteManifestNumber( manifestStream, inputFile.contentHash );
+            }
+        }
+    }
+    catch( ... )
+    {
+        delete manifestStream;
+
+        root->Delete( tmpPath );
+
+        throw;
+    }
+
+    delete manifestStream;
+
+    root->Delete( path );
+
+    bool hasSaved = root->Rename( tmpPath, path );
+
+    if ( !hasSaved )
+    {
+        root->Delete( tmpPath );
+    }
+
+    return hasSaved;
+}
+
+bool BuildManifest::IsUpToDate( const std::wstring& outputPath, const std::string& settings, CFileTranslator *srcRoot, std::vector <buildInputFile>& curInputs ) const
+{
+    // Do not hold the lock while we are comparing file contents.
+    buildManifestEntry prevEntry;
+    {
+        std::unique_lock <std::mutex> ctxCheck( this->lock );
+
+        auto findIter = this->entries.find( outputPath );
+
+        if ( findIter == this->entries.end() )
+        {
+            return false;
+        }
+
+        prevEntry = findIter->second;
+    }
+
+    if ( prevEntry.settings != settings )
+    {
+        return false;
+    }
+
+    size_t inputCount = curInputs.size();
+
+    if ( prevEntry.inputs.size() != inputCount )
+    {
+        return false;
+    }
+
+    for ( size_t n = 0; n < inputCount; n++ )
+    {
+        const buildInputFile& prevInput = prevEntry.inputs[ n ];
+        buildInputFile& curInput = curInputs[ n ];
+
+        if ( prevInput.relPath != curInput.relPath || prevInput.fileSize != curInput.fileSize )
+        {
+            return false;
+        }
+
+        if ( prevInput.modTime == curInput.modTime )
+        {
+            curInput.contentHash = prevInput.contentHash;
+            continue;
+        }
+
+        // The file was touched; maybe it still has the same content.
+        if ( curInput.contentHash == 0 )
+        {
+            curInput.contentHash = HashFileContent( srcRoot, curInput.relPath );
+        }
+
+        if ( curInput.contentHash != prevInput.contentHash )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void BuildManifest::SetEntry( const std::wstring& outputPath, buildManifestEntry&& entry )
+{
+    std::unique_lock <std::mutex> ctxSet( this->lock );
+
+    this->entries[ outputPath ] = std::move( entry );
+}
+
+void BuildManifest::RemoveEntry( const std::wstring& outputPath )
+{
+    std::unique_lock <std::mutex> ctxRemove( this->lock );
+
+    this->entries.erase( outputPath );
+}
+
+bool BuildManifest::QueryInputFile( CFileTranslator *srcRoot, const filePath& path, buildInputFile& inputOut )
+{
+    filePath relPath;
+
+    if ( !srcRoot->GetRelativePathFromRoot( path, true, relPath ) )
+    {
+        return false;
+    }
+
+    filesysStats stats;
+
+    if ( !srcRoot->QueryStats( path, stats ) )
+    {
+        return false;
+    }
+
+    auto wideRelPath = relPath.convert_unicode <rw::RwStaticMemAllocator> ();
+
+    inputOut.relPath = std::wstring( wideRelPath.GetConstString(), wideRelPath.GetLength() );
+    inputOut.fileSize = srcRoot->Size( path );
+    inputOut.modTime = (rw::uint64)stats.mtime;
+    inputOut.contentHash = 0;
+
+    return true;
+}
+
+rw::uint64 BuildManifest::HashFileContent( CFileTranslator *srcRoot, const std::wstring& relPath )
+{
+    rw::contentHasher hasher;
+
+    CFile *inputStream = srcRoot->Open( relPath.c_str(), L"rb" );
+
+    if ( inputStream == nullptr )
+    {
+        // Cannot match anything that was stored.
+        return 1;
+    }
+
+    try
+    {
+        char buffer[ 65536 ];
+
+        while ( true )
+        {
+            size_t readCount = inputStream->Read( buffer, sizeof( buffer ) );
+
+            if ( readCount == 0 )
+                break;
+
+            hasher.Update( buffer, readCount );
+        }
+    }
+    catch( ... )
+    {
+        delete inputStream;
+
+        throw;
+    }
+
+    delete inputStream;
+
+    rw::uint64 hash = hasher.Finish();
+
+    // Zero means "not calculated".
+    if ( hash == 0 )
+    {
+        hash = 1;
+    }
+
+    return hash;
+}
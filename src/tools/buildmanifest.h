@@ -0,0 +1,48 @@
+// Dependency manifest of the mass build tool.
+// For every built TXD we remember the files it was made of and the settings it was built with,
+// so that the next run only has to build the TXDs whose inputs have changed.
+
+#pragma once
+
+#include "shared.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+struct buildInputFile
+{
+    std::wstring relPath;
+    rw::uint64 fileSize = 0;
+    rw::uint64 modTime = 0;
+    rw::uint64 contentHash = 0;     // 0 if not calculated yet
+};
+
+struct buildManifestEntry
+{
+    std::string settings;
+    std::vector <buildInputFile> inputs;    // sorted by relPath
+};
+
+struct BuildManifest
+{
+    bool Load( CFileTranslator *root, const filePath& path );
+    bool Save( CFileTranslator *root, const filePath& path ) const;
+
+    // Returns true if the output was built from the same inputs and settings before.
+    // Files that were touched but kept their size are compared by content.
+    // Content hashes that had to be calculated are put into curInputs.
+    bool IsUpToDate( const std::wstring& outputPath, const std::string& settings, CFileTranslator *srcRoot, std::vector <buildInputFile>& curInputs ) const;
+
+    // Safe to call from multiple threads.
+    void SetEntry( const std::wstring& outputPath, buildManifestEntry&& entry );
+    void RemoveEntry( const std::wstring& outputPath );
+
+    static bool QueryInputFile( CFileTranslator *srcRoot, const filePath& path, buildInputFile& inputOut );
+    static rw::uint64 HashFileContent( CFileTranslator *srcRoot, const std::wstring& relPath );
+
+private:
+    mutable std::mutex lock;
+    std::map <std::wstring, buildManifestEntry> entries;
+};
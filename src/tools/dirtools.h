@@ -29,6 +29,9 @@ struct gtaFileProcessor
         traverse.use_compressed_img_archives = this->use_compressed_img_archives;
 
         discHandle->ScanDirectory( "//", "*", true, nullptr, _discFileCallback, &traverse );
+
+        // The sentry may still have files queued for the build root.
+        theSentry->FlushPendingFiles();
     }
 
     inline void setArchiveReconstruction( bool doReconstruct )
@@ -202,6 +205,12 @@ private:
 
                                     srcIMGRoot->ScanDirectory( "//", "*", true, nullptr, _discFileCallback, &traverse );
 
+                                    // All files have to be inside of the output root before it is saved.
+                                    if ( info->sentry->FlushPendingFiles() )
+                                    {
+                                        traverse.anyWork = true;
+                                    }
+
                                     if ( outputRoot_archive != nullptr )
                                     {
                                         module->OnMessage( "writing " );
@@ -0,0 +1,385 @@
+#include "mainwindow.h"
+
+#include "texconvcache.h"
+
+#include "dirtools.h"
+
+#include <random>
+
+// Increase this whenever cached results of older builds must not be used anymore.
+static const rw::uint32 CONVERSION_CACHE_VERSION = 2;
+
+TextureConversionCache::TextureConversionCache( rw::Interface *rwEngine )
+{
+    this->rwEngine = rwEngine;
+    this->cacheRoot = nullptr;
+    this->instanceId = (rw::uint32)std::random_device()();
+    this->tmpEntryCounter = 0;
+}
+
+TextureConversionCache::~TextureConversionCache( void )
+{
+    if ( CFileTranslator *cacheRoot = this->cacheRoot )
+    {
+        delete cacheRoot;
+    }
+}
+
+bool TextureConversionCache::Open( const wchar_t *cacheRootPath )
+{
+    if ( this->cacheRoot != nullptr )
+    {
+        return true;
+    }
+
+    CFileTranslator *cacheRoot = nullptr;
+
+    bool hasCacheRoot = obtainAbsolutePath( cacheRootPath, cacheRoot, true, true );
+
+    if ( !hasCacheRoot )
+    {
+        return false;
+    }
+
+    this->cacheRoot = cacheRoot;
+
+    return true;
+}
+
+conversionCacheKey TextureConversionCache::MakeKey( rw::TextureBase *inputTexture ) const
+{
+    rw::Interface *rwEngine = this->rwEngine;
+
+    conversionCacheKey key;
+
+    if ( rw::Raster *inputRaster = inputTexture->GetRaster() )
+    {
+        key.contentHash = inputRaster->getContentHash();
+    }
+
+    key.AddParam( CONVERSION_CACHE_VERSION );
+
+    // The result filtering depends on the original filtering.
+    key.AddParam( inputTexture->GetFilterMode() );
+    key.AddParam( inputTexture->GetEngineVersion() );
+
+    // Those runtimes produce different pixels.
+    key.AddParam( rwEngine->GetPaletteRuntime() );
+    key.AddParam( rwEngine->GetDXTRuntime() );
+    key.AddParam( rwEngine->GetATCRuntime() );
+    key.AddParam( rwEngine->GetPVRRuntime() );
+    key.AddParam( rwEngine->GetPVRCompressionQuality() );
+
+    // Those decide how rasters are transformed between formats and platforms.
+    key.AddParam( rwEngine->GetFixIncompatibleRasters() );
+    key.AddParam( rwEngine->GetCompatTransformNativeImaging() );
+    key.AddParam( rwEngine->GetPreferPackedSampleExport() );
+    key.AddParam( rwEngine->GetDXTPackedDecompression() );
+
+    return key;
+}
+
+filePath TextureConversionCache::GetEntryPath( const conversionCacheKey& key ) const
+{
+    char entryName[ 64 ];
+
+    snprintf( entryName, sizeof( entryName ), "%016llx%016llx.rwtex", (unsigned long long)key.contentHash, (unsigned long long)key.paramHasher.Finish() );
+
+    return filePath( entryName );
+}
+
+bool TextureConversionCache::Fetch( rw::TextureBase *texture, const conversionCacheKey& key )
+{
+    CFileTranslator *cacheRoot = this->cacheRoot;
+
+    if ( cacheRoot == nullptr || key.contentHash == 0 )
+    {
+        return false;
+    }
+
+    filePath entryPath = GetEntryPath( key );
+
+    CFile *entryStream;
+    {
+        // The translator is not made for concurrent access.
+        // Entries are read and written outside of the lock because every thread has its own stream.
+        std::unique_lock <std::mutex> ctxOpen( this->lock );
+
+        entryStream = cacheRoot->Open( entryPath, "rb" );
+    }
+
+    if ( entryStream == nullptr )
+    {
+        return false;
+    }
+
+    rw::Interface *rwEngine = this->rwEngine;
+
+    bool hasFetched = false;
+    bool isBrokenEntry = false;
+
+    try
+    {
+        rw::Stream *rwEntryStream = RwStreamCreateTranslated( rwEngine, entryStream );
+
+        if ( rwEntryStream )
+        {
+            try
+            {
+                rw::RwObject *rwObj = rwEngine->Deserialize( rwEntryStream );
+
+                if ( rwObj )
+                {
+                    try
+                    {
+                        rw::TextureBase *cachedTex = rw::ToTexture( rwEngine, rwObj );
+
+                        if ( cachedTex != nullptr && cachedTex->GetRaster() != nullptr )
+                        {
+                            // Taking the raster would also take its version, so we keep ours.
+                            rw::LibraryVersion texVersion = texture->GetEngineVersion();
+
+                            texture->SetRaster( cachedTex->GetRaster() );
+                            texture->SetFilterMode( cachedTex->GetFilterMode() );
+
+                            texture->SetEngineVersion( texVersion );
+
+                            hasFetched = true;
+                        }
+                        else
+                        {
+                            isBrokenEntry = true;
+                        }
+                    }
+                    catch( ... )
+                    {
+                        rwEngine->DeleteRwObject( rwObj );
+
+                        throw;
+                    }
+
+                    rwEngine->DeleteRwObject( rwObj );
+                }
+                else
+                {
+                    isBrokenEntry = true;
+                }
+            }
+            catch( ... )
+            {
+                rwEngine->DeleteStream( rwEntryStream );
+
+                throw;
+            }
+
+            rwEngine->DeleteStream( rwEntryStream );
+        }
+    }
+    catch( rw::RwException& )
+    {
+        // A damaged entry is just a cache miss.
+        isBrokenEntry = true;
+    }
+    catch( ... )
+    {
+        std::unique_lock <std::mutex> ctxClose( this->lock );
+
+        delete entryStream;
+
+        throw;
+    }
+
+    std::unique_lock <std::mutex> ctxClose( this->lock );
+
+    delete entryStream;
+
+    if ( isBrokenEntry )
+    {
+        cacheRoot->Delete( entryPath );
+    }
+    else if ( hasFetched )
+    {
+        // Prune drops the entries that were not used for the longest time.
+        // Not every file system updates access times, so we mark the entry as modified.
+        if ( CFile *touchStream = cacheRoot->Open( entryPath, "rb+" ) )
+        {
+            filesysStats stats;
+
+            if ( touchStream->QueryStats( stats ) )
+            {
+                time_t useTime = time( nullptr );
+
+                touchStream->SetFileTimes( useTime, stats.ctime, useTime );
+            }
+
+            delete touchStream;
+        }
+    }
+
+    return hasFetched;
+}
+
+void TextureConversionCache::Store( rw::TextureBase *texture, const conversionCacheKey& key )
+{
+    CFileTranslator *cacheRoot = this->cacheRoot;
+
+    if ( cacheRoot == nullptr || key.contentHash == 0 || texture->GetRaster() == nullptr )
+    {
+        return;
+    }
+
+    filePath entryPath = GetEntryPath( key );
+
+    // Write into a temporary file first so that no half-written entry can ever be fetched.
+    // Multiple builders can store the same entry at the same time, so every write gets its own file.
+    filePath tmpEntryPath = entryPath;
+    {
+        char tmpSuffix[ 32 ];
+
+        snprintf( tmpSuffix, sizeof( tmpSuffix ), ".%08x.%u.tmp", (unsigned int)this->instanceId, (unsigned int)this->tmpEntryCounter.fetch_add( 1 ) );
+
+        tmpEntryPath += tmpSuffix;
+    }
+
+    CFile *entryStream;
+    {
+        std::unique_lock <std::mutex> ctxOpen( this->lock );
+
+        entryStream = cacheRoot->Open( tmpEntryPath, "wb" );
+    }
+
+    if ( entryStream == nullptr )
+    {
+        return;
+    }
+
+    rw::Interface *rwEngine = this->rwEngine;
+
+    bool hasWritten = false;
+
+    try
+    {
+        rw::Stream *rwEntryStream = RwStreamCreateTranslated( rwEngine, entryStream );
+
+        if ( rwEntryStream )
+        {
+            try
+            {
+                rwEngine->Serialize( texture, rwEntryStream );
+            }
+            catch( ... )
+            {
+                rwEngine->DeleteStream( rwEntryStream );
+
+                throw;
+            }
+
+            rwEngine->DeleteStream( rwEntryStream );
+
+            hasWritten = true;
+        }
+    }
+    catch( rw::RwException& )
+    {
+        // Not every texture can be written on its own; we just do not cache it then.
+    }
+    catch( ... )
+    {
+        std::unique_lock <std::mutex> ctxClose( this->lock );
+
+        delete entryStream;
+
+        cacheRoot->Delete( tmpEntryPath );
+
+        throw;
+    }
+
+    std::unique_lock <std::mutex> ctxCommit( this->lock );
+
+    delete entryStream;
+
+    if ( hasWritten )
+    {
+        // Replace any previous entry.
+        cacheRoot->Delete( entryPath );
+
+        hasWritten = cacheRoot->Rename( tmpEntryPath, entryPath );
+    }
+
+    if ( !hasWritten )
+    {
+        cacheRoot->Delete( tmpEntryPath );
+    }
+}
+
+void TextureConversionCache::Prune( rw::uint64 maxSize )
+{
+    CFileTranslator *cacheRoot = this->cacheRoot;
+
+    if ( cacheRoot == nullptr )
+    {
+        return;
+    }
+
+    std::unique_lock <std::mutex> ctxPrune( this->lock );
+
+    struct cacheEntryInfo
+    {
+        filePath path;
+        rw::uint64 size;
+        time_t useTime;
+    };
+
+    std::vector <cacheEntryInfo> entries;
+
+    rw::uint64 totalSize = 0;
+
+    cacheRoot->ScanDirectory( "//", "*.rwtex", false, nullptr,
+        [&]( const filePath& entryPath )
+        {
+            filesysStats stats;
+
+            if ( !cacheRoot->QueryStats( entryPath, stats ) )
+            {
+                return;
+            }
+
+            cacheEntryInfo info;
+            info.path = entryPath;
+            info.size = (rw::uint64)cacheRoot->Size( entryPath );
+
+            // Not every file system keeps access times up to date.
+            info.useTime = std::max( stats.atime, stats.mtime );
+
+            totalSize += info.size;
+
+            entries.push_back( std::move( info ) );
+        }, nullptr
+    );
+
+    if ( totalSize <= maxSize )
+    {
+        return;
+    }
+
+    // Drop the entries that were not used for the longest time first.
+    std::sort( entries.begin(), entries.end(),
+        []( const cacheEntryInfo& left, const cacheEntryInfo& right )
+        {
+            return ( left.useTime < right.useTime );
+        }
+    );
+
+    for ( const cacheEntryInfo& info : entries )
+    {
+        if ( totalSize <= maxSize )
+        {
+            break;
+        }
+
+        if ( cacheRoot->Delete( info.path ) )
+        {
+            totalSize -= info.size;
+        }
+    }
+}
@@ -0,0 +1,78 @@
+// Persistent texture conversion cache for the mass tools.
+// Results of expensive raster operations (conversion, compression, mipmap generation,
+// palettization) are stored on disk, keyed by the content of the input raster and all
+// parameters of the operations. Incremental runs only have to process changed textures.
+// The cache is size-limited; the oldest entries are dropped by Prune.
+
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+#include <mutex>
+
+struct conversionCacheKey
+{
+    inline conversionCacheKey( void )
+    {
+        this->contentHash = 0;
+    }
+
+    // Every parameter that can change the resulting raster has to be added.
+    template <typename valueType>
+    inline void AddParam( const valueType& value )
+    {
+        this->paramHasher.UpdateValue( value );
+    }
+
+    inline void AddParam( const rw::LibraryVersion& version )
+    {
+        AddParam( version.rwLibMajor );
+        AddParam( version.rwLibMinor );
+        AddParam( version.rwRevMajor );
+        AddParam( version.rwRevMinor );
+    }
+
+    rw::uint64 contentHash;
+    rw::contentHasher paramHasher;
+};
+
+struct TextureConversionCache
+{
+    TextureConversionCache( rw::Interface *rwEngine );
+    ~TextureConversionCache( void );
+
+    bool Open( const wchar_t *cacheRootPath );
+
+    inline bool IsOpen( void ) const
+    {
+        return ( this->cacheRoot != nullptr );
+    }
+
+    // Starts a key for the given input texture.
+    // Also takes the engine settings into account that change conversion results.
+    conversionCacheKey MakeKey( rw::TextureBase *inputTexture ) const;
+
+    // Fetch, Store and Prune can be called from multiple threads; they take turns on the cache directory.
+
+    // Replaces the raster and filtering of the texture with the cached result, if there is one.
+    bool Fetch( rw::TextureBase *texture, const conversionCacheKey& key );
+
+    // Remembers the processed texture under the key. Failures are not fatal.
+    void Store( rw::TextureBase *texture, const conversionCacheKey& key );
+
+    // Deletes the oldest entries until the cache takes at most maxSize bytes.
+    void Prune( rw::uint64 maxSize );
+
+private:
+    filePath GetEntryPath( const conversionCacheKey& key ) const;
+
+    rw::Interface *rwEngine;
+    CFileTranslator *cacheRoot;
+
+    std::mutex lock;
+
+    // Temporary entry names are made from both, so that other builders on the same cache do not clash.
+    rw::uint32 instanceId;
+    std::atomic <rw::uint32> tmpEntryCounter;
+};
@@ -9,9 +9,17 @@
 #include <gtaconfig/include.h>
 
 #include <regex>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <exception>
 
 #include "imagepipe.hxx"
 
+#include "buildmanifest.h"
+
 static const std::regex gameVer_regex( "(\\w+),(\\w+)" );
 static const std::regex game_regex( "(\\w+),(\\w+)" );
 
@@ -279,7 +287,8 @@ void BuildSingleTexture(
     rw::Interface *rwEngine, rw::TexDictionary *texDict,
     const filePath& texturePath, rw::Stream *imgStream,
     TxdBuildModule *module, const TxdBuildModule::run_config& config, const filePath& extention,
-    const ConfigNode& cfgParent
+    const ConfigNode& cfgParent,
+    TextureConversionCache *convCache
 )
 {
     rw::TextureBase *imgTex = BuilderMakeTextureFromStream( rwEngine, imgStream, extention, module, config.targetGame, config.targetPlatform, cfgParent );
@@ -314,79 +323,144 @@ void BuildSingleTexture(
                 GetConfigNodeAddressMode( cfgParent, "vAddress", rw::RWTEXADDRESS_WRAP )
             );
 
-            // Scale the raster?
+            // Skip all the work if an earlier run did build the same image the same way.
+            conversionCacheKey cacheKey;
+
+            bool hasCachedResult = false;
+
+            if ( convCache )
             {
-                std::string strSize;
+                cacheKey = convCache->MakeKey( imgTex );
 
-                if ( cfgParent.GetString( "size", strSize ) )
                 {
-                    // Try parsing a valid size tuple.
-                    // If successful, resize things.
                     unsigned int width, height;
 
-                    int parseCount = sscanf( strSize.c_str(), "%u,%u", &width, &height );
+                    bool hasSize = ( sscanf( GetConfigNodeString( cfgParent, "size", "" ).c_str(), "%u,%u", &width, &height ) == 2 );
 
-                    if ( parseCount == 2 )
-                    {
-                        // Do the resize with default filters.
-                        rw::Raster *texRaster = imgTex->GetRaster();
+                    cacheKey.AddParam( hasSize );
 
-                        if ( texRaster )
-                        {
-                            texRaster->resize( width, height );
-                        }
+                    if ( hasSize )
+                    {
+                        cacheKey.AddParam( width );
+                        cacheKey.AddParam( height );
                     }
                 }
-            }
 
-            // Generate mipmaps?
-            if ( GetConfigNodeBoolean( cfgParent, "genMipmaps", false ) )
-            {
-                rw::Raster *texRaster = imgTex->GetRaster();
+                bool genMipmaps = GetConfigNodeBoolean( cfgParent, "genMipmaps", false );
+
+                cacheKey.AddParam( genMipmaps );
 
-                if ( texRaster )
+                if ( genMipmaps )
                 {
-                    int genMipMaxLevel = GetConfigNodeInt( cfgParent, "genMipMaxLevel", 32 );
+                    cacheKey.AddParam( GetConfigNodeInt( cfgParent, "genMipMaxLevel", 32 ) );
+                }
+
+                bool palettized = GetConfigNodeBoolean( cfgParent, "palettized", false );
+
+                cacheKey.AddParam( palettized );
+
+                if ( palettized )
+                {
+                    rw::ePaletteType paletteType = rw::PALETTE_8BIT;
+
+                    getPaletteTypeFromString( GetConfigNodeString( cfgParent, "palType", "PAL8" ).c_str(), paletteType );
 
-                    texRaster->generateMipmaps( genMipMaxLevel );
+                    cacheKey.AddParam( paletteType );
                 }
+
+                bool compressed = GetConfigNodeBoolean( cfgParent, "compressed", false );
+
+                cacheKey.AddParam( compressed );
+
+                if ( compressed )
+                {
+                    cacheKey.AddParam( GetConfigNodeFloat( cfgParent, "comprQuality", 1.0 ) );
+                }
+
+                hasCachedResult = convCache->Fetch( imgTex, cacheKey );
             }
 
-            // We want to palettize?
-            if ( GetConfigNodeBoolean( cfgParent, "palettized", false ) )
+            if ( !hasCachedResult )
             {
-                rw::Raster *texRaster = imgTex->GetRaster();
-
-                if ( texRaster )
+                // Scale the raster?
                 {
-                    // Decide what palette format.
-                    rw::ePaletteType paletteType = rw::PALETTE_8BIT;
+                    std::string strSize;
+
+                    if ( cfgParent.GetString( "size", strSize ) )
                     {
-                        std::string palName = GetConfigNodeString( cfgParent, "palType", "PAL8" );
+                        // Try parsing a valid size tuple.
+                        // If successful, resize things.
+                        unsigned int width, height;
+
+                        int parseCount = sscanf( strSize.c_str(), "%u,%u", &width, &height );
 
-                        getPaletteTypeFromString( palName.c_str(), paletteType );
+                        if ( parseCount == 2 )
+                        {
+                            // Do the resize with default filters.
+                            rw::Raster *texRaster = imgTex->GetRaster();
+
+                            if ( texRaster )
+                            {
+                                texRaster->resize( width, height );
+                            }
+                        }
                     }
+                }
+
+                // Generate mipmaps?
+                if ( GetConfigNodeBoolean( cfgParent, "genMipmaps", false ) )
+                {
+                    rw::Raster *texRaster = imgTex->GetRaster();
 
-                    texRaster->convertToPalette( paletteType, rw::RASTER_8888 );    // maximum palette quality.
+                    if ( texRaster )
+                    {
+                        int genMipMaxLevel = GetConfigNodeInt( cfgParent, "genMipMaxLevel", 32 );
+
+                        texRaster->generateMipmaps( genMipMaxLevel );
+                    }
                 }
-            }
 
-            // Maybe this texture wants to be compressed.
-            if ( GetConfigNodeBoolean( cfgParent, "compressed", false ) )
-            {
-                // Lets do it.
-                rw::Raster *texRaster = imgTex->GetRaster();
+                // We want to palettize?
+                if ( GetConfigNodeBoolean( cfgParent, "palettized", false ) )
+                {
+                    rw::Raster *texRaster = imgTex->GetRaster();
+
+                    if ( texRaster )
+                    {
+                        // Decide what palette format.
+                        rw::ePaletteType paletteType = rw::PALETTE_8BIT;
+                        {
+                            std::string palName = GetConfigNodeString( cfgParent, "palType", "PAL8" );
+
+                            getPaletteTypeFromString( palName.c_str(), paletteType );
+                        }
+
+                        texRaster->convertToPalette( paletteType, rw::RASTER_8888 );    // maximum palette quality.
+                    }
+                }
 
-                if ( texRaster )
+                // Maybe this texture wants to be compressed.
+                if ( GetConfigNodeBoolean( cfgParent, "compressed", false ) )
                 {
-                    float comprQuality = (float)GetConfigNodeFloat( cfgParent, "comprQuality", 1.0 );
+                    // Lets do it.
+                    rw::Raster *texRaster = imgTex->GetRaster();
 
-                    texRaster->compress( comprQuality );
+                    if ( texRaster )
+                    {
+                        float comprQuality = (float)GetConfigNodeFloat( cfgParent, "comprQuality", 1.0 );
+
+                        texRaster->compress( comprQuality );
+                    }
                 }
-            }
 
-            // ;)
-            imgTex->fixFiltering();
+                // ;)
+                imgTex->fixFiltering();
+
+                if ( convCache )
+                {
+                    convCache->Store( imgTex, cacheKey );
+                }
+            }
 
             // Add our texture to the dictionary!
             imgTex->AddToDictionary( texDict );
@@ -670,12 +744,293 @@ void ReadConfigurationBlock(
     }
 }
 
+// Optional settings of the build process itself, from a "_massbuild.ini" in the game root.
+// The [main] block takes conversionCache (directory, relative to the working directory; empty to disable),
+// conversionCacheMaxSize (megabytes), incrementalBuild (boolean) and jobs (0 for one per logical processor).
+static void ReadToolConfiguration( CFileTranslator *gameRoot, const filePath& path, TxdBuildModule::run_config& config )
+{
+    if ( CFile *iniStream = gameRoot->Open( path, "rb" ) )
+    {
+        CINI *iniConfig = LoadINI( iniStream );
+
+        delete iniStream;
+
+        if ( iniConfig )
+        {
+            if ( CINI::Entry *mainEntry = iniConfig->GetEntry( "main" ) )
+            {
+                if ( const char *newConversionCacheRoot = mainEntry->Get( "conversionCache" ) )
+                {
+                    config.conversionCacheRoot = CharacterUtil::ConvertStrings <char8_t, wchar_t, rw::RwStaticMemAllocator> ( (const char8_t*)newConversionCacheRoot );
+                }
+
+                if ( mainEntry->Find( "conversionCacheMaxSize" ) )
+                {
+                    int cacheMaxSizeInt = mainEntry->GetInt( "conversionCacheMaxSize" );
+
+                    if ( cacheMaxSizeInt >= 0 )
+                    {
+                        config.conversionCacheMaxSizeMB = (unsigned int)cacheMaxSizeInt;
+                    }
+                }
+
+                if ( mainEntry->Find( "incrementalBuild" ) )
+                {
+                    config.incrementalBuild = mainEntry->GetBool( "incrementalBuild" );
+                }
+
+                if ( mainEntry->Find( "jobs" ) )
+                {
+                    int jobCountInt = mainEntry->GetInt( "jobs" );
+
+                    if ( jobCountInt >= 0 )
+                    {
+                        config.jobCount = (unsigned int)jobCountInt;
+                    }
+                }
+            }
+
+            delete iniConfig;
+        }
+    }
+}
+
+// Describes everything besides the input files that changes the built TXDs.
+static std::string GetBuildSettingsString( rw::Interface *rwEngine, const TxdBuildModule::run_config& config )
+{
+    std::stringstream settings;
+
+    settings
+        << "platform=" << (int)config.targetPlatform
+        << ";game=" << (int)config.targetGame
+        << ";mipmaps=" << config.generateMipmaps << "," << config.curMipMaxLevel
+        << ";compress=" << config.doCompress << "," << config.compressionQuality
+        << ";palettize=" << config.doPalettize << "," << (int)config.paletteType
+        << ";palRuntime=" << (int)rwEngine->GetPaletteRuntime()
+        << ";dxtRuntime=" << (int)rwEngine->GetDXTRuntime()
+        << ";atcRuntime=" << (int)rwEngine->GetATCRuntime()
+        << ";pvrRuntime=" << (int)rwEngine->GetPVRRuntime() << "," << (int)rwEngine->GetPVRCompressionQuality()
+        << ";fixIncompatible=" << rwEngine->GetFixIncompatibleRasters()
+        << ";compatTransform=" << rwEngine->GetCompatTransformNativeImaging()
+        << ";packedSamples=" << rwEngine->GetPreferPackedSampleExport() << "," << rwEngine->GetDXTPackedDecompression();
+
+    return settings.str();
+}
+
+struct buildSourceFile
+{
+    filePath path;
+    buildInputFile info;
+};
+
+// The build module is not safe to call from multiple threads, so the build threads go through this.
+// Warnings can be issued while a stream codec is running, hence the recursive lock.
+struct txdBuildSerializedModule : public TxdBuildModule
+{
+    inline txdBuildSerializedModule( rw::Interface *rwEngine, TxdBuildModule *module ) : TxdBuildModule( rwEngine )
+    {
+        this->module = module;
+    }
+
+    void OnMessage( const rw::rwStaticString <char>& msg ) override
+    {
+        std::unique_lock <std::recursive_mutex> ctxMessage( this->lock );
+
+        this->module->OnMessage( msg );
+    }
+
+    void OnMessage( const rw::rwStaticString <wchar_t>& msg ) override
+    {
+        std::unique_lock <std::recursive_mutex> ctxMessage( this->lock );
+
+        this->module->OnMessage( msg );
+    }
+
+    CFile* WrapStreamCodec( CFile *compressed ) override
+    {
+        std::unique_lock <std::recursive_mutex> ctxCodec( this->lock );
+
+        return this->module->WrapStreamCodec( compressed );
+    }
+
+private:
+    TxdBuildModule *module;
+
+    std::recursive_mutex lock;
+};
+
+// Builds independent TXDs on multiple threads. The calling thread takes part aswell.
+// If the calling thread is asked to terminate, the workers stop after their current TXD.
+struct txdBuildExecutor
+{
+    inline txdBuildExecutor( rw::Interface *rwEngine, unsigned int jobCount )
+    {
+        this->rwEngine = rwEngine;
+
+        if ( jobCount == 0 )
+        {
+            jobCount = rw::GetParallelCapability( rwEngine );
+        }
+
+        this->jobCount = std::max( jobCount, 1u );
+
+        // Workers have to run with the same configuration as we do.
+        this->threadConfig = nullptr;
+
+        if ( this->jobCount > 1 )
+        {
+            this->threadConfig = rw::CaptureRuntimeConfig( rwEngine );
+        }
+
+        this->itemCount = 0;
+        this->nextItem = 0;
+        this->isTerminating = false;
+    }
+
+    inline ~txdBuildExecutor( void )
+    {
+        if ( this->threadConfig )
+        {
+            rw::DeleteRuntimeConfig( this->rwEngine, this->threadConfig );
+        }
+    }
+
+    inline void Run( size_t itemCount, std::function <void ( size_t )> cb )
+    {
+        this->itemCallback = std::move( cb );
+        this->itemCount = itemCount;
+        this->nextItem = 0;
+        this->isTerminating = false;
+        this->workerError = nullptr;
+
+        size_t workerCount = ( std::min( (size_t)this->jobCount, itemCount ) );
+
+        if ( workerCount > 0 )
+        {
+            workerCount--;
+        }
+
+        std::vector <rw::thread_t> workers;
+
+        try
+        {
+            for ( size_t n = 0; n < workerCount; n++ )
+            {
+                rw::thread_t workerThread = rw::MakeThread( this->rwEngine, _worker_entry, this );
+
+                if ( workerThread == nullptr )
+                {
+                    // We simply do with less workers.
+                    break;
+                }
+
+                workers.push_back( workerThread );
+
+                rw::ResumeThread( this->rwEngine, workerThread );
+            }
+
+            // Help out ourselves.
+            this->ProcessItems();
+        }
+        catch( ... )
+        {
+            this->isTerminating = true;
+
+            this->JoinWorkers( workers );
+
+            throw;
+        }
+
+        this->JoinWorkers( workers );
+
+        if ( std::exception_ptr error = this->workerError )
+        {
+            this->workerError = nullptr;
+
+            std::rethrow_exception( error );
+        }
+    }
+
+private:
+    inline void ProcessItems( void )
+    {
+        while ( this->isTerminating == false )
+        {
+            size_t itemIndex = this->nextItem.fetch_add( 1 );
+
+            if ( itemIndex >= this->itemCount )
+                break;
+
+            this->itemCallback( itemIndex );
+        }
+    }
+
+    inline void JoinWorkers( std::vector <rw::thread_t>& workers )
+    {
+        for ( rw::thread_t workerThread : workers )
+        {
+            rw::JoinThread( this->rwEngine, workerThread );
+            rw::CloseThread( this->rwEngine, workerThread );
+        }
+
+        workers.clear();
+    }
+
+    static void _worker_entry( rw::thread_t threadHandle, rw::Interface *rwEngine, void *ud )
+    {
+        txdBuildExecutor *executor = (txdBuildExecutor*)ud;
+
+        try
+        {
+            rw::AssignThreadedRuntimeConfig( rwEngine, executor->threadConfig );
+
+            executor->ProcessItems();
+        }
+        catch( ... )
+        {
+            std::unique_lock <std::mutex> ctxError( executor->errorLock );
+
+            if ( !executor->workerError )
+            {
+                executor->workerError = std::current_exception();
+            }
+
+            // Do not start any more TXDs.
+            executor->isTerminating = true;
+        }
+
+        rw::ReleaseThreadedRuntimeConfig( rwEngine );
+    }
+
+    rw::Interface *rwEngine;
+    unsigned int jobCount;
+
+    rw::runtimeConfig_t threadConfig;
+
+    std::function <void ( size_t )> itemCallback;
+    size_t itemCount;
+    std::atomic <size_t> nextItem;
+    std::atomic <bool> isTerminating;
+
+    std::mutex errorLock;
+    std::exception_ptr workerError;
+};
+
 void BuildTXDArchives(
     rw::Interface *rwEngine,
-    TxdBuildModule *module, CFileTranslator *gameRoot, CFileTranslator *outputRoot,
-    const TxdBuildModule::run_config& config, const ConfigNode& cfgNode
+    TxdBuildModule *buildModule, CFileTranslator *gameRoot, CFileTranslator *outputRoot,
+    const TxdBuildModule::run_config& config, const ConfigNode& cfgNode,
+    TextureConversionCache *convCache, BuildManifest *manifest
 )
 {
+    txdBuildSerializedModule serializedModule( rwEngine, buildModule );
+
+    TxdBuildModule *module = &serializedModule;
+
+    // The settings of the build window apply to every TXD.
+    // Settings from config blocks are tracked through the .ini files themselves.
+    const std::string buildSettings = GetBuildSettingsString( rwEngine, config );
+
     // Process things.
     auto dir_callback = [&]( const filePath& dirPath )
     {
@@ -704,6 +1059,74 @@ void BuildTXDArchives(
             // We can only continue if we actually have a valid location to write our TXD to.
             if ( hasTXDWritePath )
             {
+                // Every file in the directory is an input of the TXD, including the config blocks.
+                std::vector <buildSourceFile> sourceFiles;
+
+                bool canTrackInputs = true;
+
+                gameRoot->ScanDirectory( dirPath, "*", false, nullptr,
+                    [&]( const filePath& texturePath )
+                    {
+                        buildSourceFile srcFile;
+                        srcFile.path = texturePath;
+
+                        if ( !BuildManifest::QueryInputFile( gameRoot, texturePath, srcFile.info ) )
+                        {
+                            canTrackInputs = false;
+                        }
+
+                        sourceFiles.push_back( std::move( srcFile ) );
+                    }, nullptr
+                );
+
+                std::sort( sourceFiles.begin(), sourceFiles.end(),
+                    []( const buildSourceFile& left, const buildSourceFile& right )
+                    {
+                        return ( left.info.relPath < right.info.relPath );
+                    }
+                );
+
+                std::vector <buildInputFile> inputs;
+
+                for ( const buildSourceFile& srcFile : sourceFiles )
+                {
+                    inputs.push_back( srcFile.info );
+                }
+
+                auto wideTXDWritePath = txdWritePath.convert_unicode <rw::RwStaticMemAllocator> ();
+
+                std::wstring manifestKey( wideTXDWritePath.GetConstString(), wideTXDWritePath.GetLength() );
+
+                // Skip this TXD if nothing has changed since it was built.
+                if ( manifest && canTrackInputs && outputRoot->Exists( txdWritePath ) )
+                {
+                    if ( manifest->IsUpToDate( manifestKey, buildSettings, gameRoot, inputs ) )
+                    {
+                        // Remember new timestamps so that touched files are not compared again.
+                        buildManifestEntry entry;
+                        entry.settings = buildSettings;
+                        entry.inputs = std::move( inputs );
+
+                        manifest->SetEntry( manifestKey, std::move( entry ) );
+
+                        module->OnMessage( L"up to date '" + wideTXDWritePath + L"'\n" );
+                        return;
+                    }
+                }
+
+                // Remember the content of the inputs before we build from them.
+                // If they change during the build then the next build notices it.
+                if ( manifest && canTrackInputs )
+                {
+                    for ( buildInputFile& inputFile : inputs )
+                    {
+                        if ( inputFile.contentHash == 0 )
+                        {
+                            inputFile.contentHash = BuildManifest::HashFileContent( gameRoot, inputFile.relPath );
+                        }
+                    }
+                }
+
                 // Send a status message about our build process.
                 module->OnMessage( L"building '" + txdWritePath.convert_unicode <rw::RwStaticMemAllocator> () + L"'...\n" );
 
@@ -803,7 +1226,8 @@ void BuildTXDArchives(
                                                             rwEngine, texDict,
                                                             texturePath, imgStream,
                                                             module, config, extOut,
-                                                            textureCfgNode
+                                                            textureCfgNode,
+                                                            convCache
                                                         );
                                                     }
                                                 }
@@ -823,6 +1247,9 @@ void BuildTXDArchives(
                                         // Tell the runtime about any errors.
                                         module->OnMessage( "failed to build texture: " + except.message + '\n' );
 
+                                        // Try again next time.
+                                        canTrackInputs = false;
+
                                         // Continue. This is just one of many textures.
                                     }
                                 }
@@ -844,9 +1271,14 @@ void BuildTXDArchives(
                             rw::CheckThreadHazards( rwEngine );
                         };
 
-                        gameRoot->ScanDirectory( dirPath, "*", false, nullptr, std::move( per_dir_file_cb ), nullptr );
+                        for ( const buildSourceFile& srcFile : sourceFiles )
+                        {
+                            per_dir_file_cb( srcFile.path );
+                        }
                     }
 
+                    bool hasWrittenTXD = false;
+
                     // If we have at least one texture in this texture dictionary, we can initialize it and write away.
                     if ( texDict->GetTextureCount() != 0 )
                     {
@@ -887,6 +1319,8 @@ void BuildTXDArchives(
                                     }
 
                                     rwEngine->DeleteStream( txdStream );
+
+                                    hasWrittenTXD = true;
                                 }
                             }
                             catch( ... )
@@ -903,11 +1337,33 @@ void BuildTXDArchives(
                             module->OnMessage( L"failed to open TXD for writing\n" );
                         }
                     }
+
+                    // Remember what this TXD was built from.
+                    if ( manifest )
+                    {
+                        if ( hasWrittenTXD && canTrackInputs )
+                        {
+                            buildManifestEntry entry;
+                            entry.settings = buildSettings;
+                            entry.inputs = std::move( inputs );
+
+                            manifest->SetEntry( manifestKey, std::move( entry ) );
+                        }
+                        else
+                        {
+                            manifest->RemoveEntry( manifestKey );
+                        }
+                    }
                 }
                 catch( ... )
                 {
                     rwEngine->DeleteRwObject( texDict );
 
+                    if ( manifest )
+                    {
+                        manifest->RemoveEntry( manifestKey );
+                    }
+
                     throw;
                 }
 
@@ -924,14 +1380,50 @@ void BuildTXDArchives(
         }
     };
 
-    // Let us use the kickass C++11 lambdas :)
-    gameRoot->ScanDirectory( "//", "*", true, std::move( dir_callback ), NULL, NULL );
+    // Find all TXD directories first, so that they can be built in parallel.
+    std::vector <filePath> txdDirectories;
+
+    gameRoot->ScanDirectory( "//", "*", true,
+        [&]( const filePath& dirPath )
+        {
+            txdDirectories.push_back( dirPath );
+        }, NULL, NULL
+    );
+
+    // Warnings of every build thread have to go through the serialized module.
+    rw::WarningManagerInterface *prevWarningMan = rwEngine->GetWarningManager();
+
+    rwEngine->SetWarningManager( module );
+
+    try
+    {
+        // Let us use the kickass C++11 lambdas :)
+        txdBuildExecutor executor( rwEngine, config.jobCount );
+
+        executor.Run( txdDirectories.size(),
+            [&]( size_t dirIndex )
+            {
+                dir_callback( txdDirectories[ dirIndex ] );
+            }
+        );
+    }
+    catch( ... )
+    {
+        rwEngine->SetWarningManager( prevWarningMan );
+
+        throw;
+    }
+
+    rwEngine->SetWarningManager( prevWarningMan );
 }
 
-bool TxdBuildModule::RunApplication( const run_config& config )
+bool TxdBuildModule::RunApplication( const run_config& appConfig )
 {
     rw::Interface *rwEngine = this->rwEngine;
 
+    // The game root can refine the settings of the build process.
+    run_config config = appConfig;
+
     try
     {
         // Isolate us.
@@ -988,6 +1480,8 @@ bool TxdBuildModule::RunApplication( const run_config& config )
             {
                 try
                 {
+                    ReadToolConfiguration( gameRootTranslator, L"_massbuild.ini", config );
+
                     CFileTranslator *outputRootTranslator = nullptr;
 
                     bool hasOutputRoot = obtainAbsolutePath( config.outputRoot.GetConstString(), outputRootTranslator, true );
@@ -998,7 +1492,65 @@ bool TxdBuildModule::RunApplication( const run_config& config )
                         {
                             if ( hasGameRoot && hasOutputRoot )
                             {
-                                BuildTXDArchives( this->rwEngine, this, gameRootTranslator, outputRootTranslator, config, rootNode );
+                                // Keep the results of texture processing for the next run.
+                                TextureConversionCache convCache( rwEngine );
+
+                                bool hasConvCache = false;
+
+                                if ( config.conversionCacheRoot.IsEmpty() == false )
+                                {
+                                    hasConvCache = convCache.Open( config.conversionCacheRoot.GetConstString() );
+
+                                    if ( !hasConvCache )
+                                    {
+                                        this->OnMessage( L"could not open the conversion cache; building all textures\n" );
+                                    }
+                                }
+
+                                // Only build the TXDs whose inputs have changed since the last run.
+                                BuildManifest manifest;
+
+                                const filePath manifestPath( L"massbuild.manifest" );
+
+                                if ( config.incrementalBuild )
+                                {
+                                    manifest.Load( outputRootTranslator, manifestPath );
+                                }
+
+                                try
+                                {
+                                    BuildTXDArchives(
+                                        this->rwEngine, this, gameRootTranslator, outputRootTranslator, config, rootNode,
+                                        ( hasConvCache ? &convCache : nullptr ),
+                                        ( config.incrementalBuild ? &manifest : nullptr )
+                                    );
+                                }
+                                catch( ... )
+                                {
+                                    // Keep what we have finished so far.
+                                    if ( config.incrementalBuild )
+                                    {
+                                        manifest.Save( outputRootTranslator, manifestPath );
+                                    }
+
+                                    if ( hasConvCache )
+                                    {
+                                        convCache.Prune( (rw::uint64)config.conversionCacheMaxSizeMB * 1024 * 1024 );
+                                    }
+
+                                    throw;
+                                }
+
+                                if ( config.incrementalBuild )
+                                {
+                                    manifest.Save( outputRootTranslator, manifestPath );
+                                }
+
+                                // Keep the cache from growing without bounds.
+                                if ( hasConvCache )
+                                {
+                                    convCache.Prune( (rw::uint64)config.conversionCacheMaxSizeMB * 1024 * 1024 );
+                                }
                             }
                         }
                         catch( ... )
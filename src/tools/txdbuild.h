@@ -2,6 +2,8 @@
 
 #include "shared.h"
 
+#include "texconvcache.h"
+
 struct TxdBuildModule abstract : public MessageReceiver, public rw::WarningManagerInterface
 {
     inline TxdBuildModule( rw::Interface *rwEngine )
@@ -24,6 +26,18 @@ struct TxdBuildModule abstract : public MessageReceiver, public rw::WarningManag
         float compressionQuality = 1.0f;
         bool doPalettize = false;
         rw::ePaletteType paletteType = rw::PALETTE_NONE;
+
+        // Results of texture processing are kept here for the next run; empty to disable.
+        rw::rwStaticString <wchar_t> conversionCacheRoot;
+
+        // Oldest cache entries are deleted after the run so that the cache stays below this size.
+        unsigned int conversionCacheMaxSizeMB = 1024;
+
+        // Skip TXDs whose input files and settings did not change since the last build.
+        bool incrementalBuild = true;
+
+        // Number of TXDs that are built at the same time; 0 for one per logical processor.
+        unsigned int jobCount = 0;
     };
 
     bool RunApplication( const run_config& cfg );
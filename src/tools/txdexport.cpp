@@ -3,6 +3,12 @@
 
 #include "dirtools.h"
 
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+
 static rw::TexDictionary* RwTexDictionaryStreamRead( rw::Interface *rwEngine, CFile *stream )
 {
     rw::TexDictionary *resultDict = NULL;
@@ -47,106 +53,497 @@ static rw::TexDictionary* RwTexDictionaryStreamRead( rw::Interface *rwEngine, CF
     return resultDict;
 }
 
-static void ExportImagesFromDictionary(
-    rw::TexDictionary *texDict, CFileTranslator *outputRoot,
-    const filePath& txdFileName, const filePath& relPathFromRoot,
-    MassExportModule::eOutputType outputType,
-    const rw::rwStaticString <char>& imgFormat
+static void WriteTextureImage(
+    rw::Interface *rwEngine, rw::TextureBase *texHandle, CFileTranslator *outputRoot,
+    const filePath& targetFileName, const rw::rwStaticString <char>& imgFormat
 )
 {
-    rw::Interface *rwEngine = texDict->GetEngine();
+    rw::Raster *texRaster = texHandle->GetRaster();
+
+    if ( !texRaster )
+        return;
+
+    // Create the target stream.
+    CFile *targetStream = outputRoot->Open( targetFileName, "wb" );
+
+    if ( targetStream )
+    {
+        try
+        {
+            rw::Stream *rwStream = RwStreamCreateTranslated( rwEngine, targetStream );
+
+            if ( rwStream )
+            {
+                try
+                {
+                    // Write it!
+                    try
+                    {
+                        if ( strieq( imgFormat.GetConstString(), "RWTEX" ) )
+                        {
+                            rwEngine->Serialize( texHandle, rwStream );
+                        }
+                        else
+                        {
+                            texRaster->writeImage( rwStream, imgFormat.GetConstString() );
+                        }
+                    }
+                    catch( rw::RwException& )
+                    {
+                        // If we failed to write it, just live with it.
+                    }
+                }
+                catch( ... )
+                {
+                    rwEngine->DeleteStream( rwStream );
+
+                    throw;
+                }
+
+                rwEngine->DeleteStream( rwStream );
+            }
+        }
+        catch( ... )
+        {
+            delete targetStream;
+
+            throw;
+        }
 
-    for ( rw::TexDictionary::texIter_t iter( texDict->GetTextureIterator() ); !iter.IsEnd(); iter.Increment() )
+        delete targetStream;
+    }
+}
+
+// Image encoding is the expensive part of a mass export, so it is done by a pool of
+// worker threads. The thread that walks the game files only decodes TXDs and hands out
+// one job per texture. The job queue is bounded so that the reader cannot run away
+// with memory if the encoders fall behind.
+struct imageExportPool
+{
+    inline imageExportPool( rw::Interface *rwEngine, CFileTranslator *outputRoot, MassExportModule::eOutputType outputType, const rw::rwStaticString <char>& imgFormat )
+        : imgFormat( imgFormat )
     {
-        rw::TextureBase *texHandle = iter.Resolve();
+        this->rwEngine = rwEngine;
+        this->outputRoot = outputRoot;
+        this->outputType = outputType;
 
-        if ( rw::Raster *texRaster = texHandle->GetRaster() )
+        // The extension of the written files is the lower-case format name.
+        std::string lower_ext( imgFormat.GetConstString(), imgFormat.GetLength() );
+        std::transform( lower_ext.begin(), lower_ext.end(), lower_ext.begin(), ::tolower );
+
+        this->lowerExt = std::move( lower_ext );
+
+        this->threadConfig = nullptr;
+        this->runningJobCount = 0;
+        this->isTerminating = false;
+
+        // The reader thread is mostly busy with I/O and TXD parsing, so we give every
+        // logical processor its own encoder.
+        uint32_t workerCount = rw::GetParallelCapability( rwEngine );
+
+        if ( workerCount <= 1 )
         {
-            // Construct the target filename.
-            filePath targetFileName = relPathFromRoot;
+            // Encode on the reader thread itself.
+            workerCount = 0;
+        }
+
+        this->maxQueuedJobs = ( workerCount * 4 );
 
-            if ( outputType == MassExportModule::OUTPUT_PLAIN )
+        this->workers.reserve( workerCount );
+
+        try
+        {
+            // Workers have to run with the same configuration as we do.
+            if ( workerCount != 0 )
             {
-                // We are a plain path, which is just the texture name appended.
+                this->threadConfig = rw::CaptureRuntimeConfig( rwEngine );
             }
-            else if ( outputType == MassExportModule::OUTPUT_TXDNAME )
+
+            for ( uint32_t n = 0; n < workerCount; n++ )
             {
-                // Also put the TexDictionary name before it.
-                targetFileName += txdFileName;
-                targetFileName += "_";
+                rw::thread_t workerThread = rw::MakeThread( rwEngine, _worker_entry, this );
+
+                if ( workerThread == nullptr )
+                {
+                    // We simply do with less workers.
+                    break;
+                }
+
+                this->workers.push_back( workerThread );
+
+                rw::ResumeThread( rwEngine, workerThread );
             }
-            else if ( outputType == MassExportModule::OUTPUT_FOLDERS )
+        }
+        catch( ... )
+        {
+            this->Shutdown();
+
+            if ( this->threadConfig )
             {
-                // Instead put it inside folders.
-                targetFileName += txdFileName;
-                targetFileName += "/";
+                rw::DeleteRuntimeConfig( rwEngine, this->threadConfig );
             }
 
-            targetFileName += texHandle->GetName();
-            targetFileName += ".";
+            throw;
+        }
+    }
 
-            std::string lower_ext( imgFormat.GetConstString(), imgFormat.GetLength() );
-            std::transform( lower_ext.begin(), lower_ext.end(), lower_ext.begin(), ::tolower );
+    inline ~imageExportPool( void )
+    {
+        // If we were not finished properly then the export was cancelled.
+        // Pending jobs are dropped.
+        this->Shutdown();
 
-            targetFileName.append( lower_ext.c_str() );
+        if ( this->threadConfig )
+        {
+            rw::DeleteRuntimeConfig( this->rwEngine, this->threadConfig );
+        }
+    }
 
-            // Create the target stream.
-            CFile *targetStream = outputRoot->Open( targetFileName, "wb" );
+    // Queues all textures of a dictionary for export. Takes over ownership of texDict.
+    inline void PushDictionary( rw::TexDictionary *texDict, const filePath& txdFileName, const filePath& relPathFromRoot )
+    {
+        exportedDictionary *dictRef = new exportedDictionary( texDict );
 
-            if ( targetStream )
+        // The reader holds a reference until all jobs have been queued.
+        try
+        {
+            for ( rw::TexDictionary::texIter_t iter( texDict->GetTextureIterator() ); !iter.IsEnd(); iter.Increment() )
             {
-                try
-                {
-                    rw::Stream *rwStream = RwStreamCreateTranslated( rwEngine, targetStream );
+                rw::TextureBase *texHandle = iter.Resolve();
 
-                    if ( rwStream )
-                    {
-                        try
-                        {
-                            // Write it!
-                            try
-                            {
-                                if ( strieq( imgFormat.GetConstString(), "RWTEX" ) )
-                                {
-                                    rwEngine->Serialize( texHandle, rwStream );
-                                }
-                                else
-                                {
-                                    texRaster->writeImage( rwStream, imgFormat.GetConstString() );
-                                }
-                            }
-                            catch( rw::RwException& )
-                            {
-                                // If we failed to write it, just live with it.
-                            }
-                        }
-                        catch( ... )
-                        {
-                            rwEngine->DeleteStream( rwStream );
+                if ( texHandle->GetRaster() == nullptr )
+                    continue;
 
-                            throw;
-                        }
+                exportJob job;
+                job.dictRef = dictRef;
+                job.texHandle = texHandle;
+                job.targetFileName = this->GetTargetFileName( texHandle, txdFileName, relPathFromRoot );
 
-                        rwEngine->DeleteStream( rwStream );
-                    }
+                dictRef->refCount++;
+
+                try
+                {
+                    this->PushJob( std::move( job ) );
                 }
                 catch( ... )
                 {
-                    delete targetStream;
+                    this->ReleaseDictionary( dictRef );
 
                     throw;
                 }
+            }
+        }
+        catch( ... )
+        {
+            this->ReleaseDictionary( dictRef );
+
+            throw;
+        }
+
+        this->ReleaseDictionary( dictRef );
+    }
+
+    // Waits for all queued jobs to be written and stops the workers.
+    // Rethrows the first error that happened on a worker.
+    inline void Finish( void )
+    {
+        if ( this->workers.empty() == false )
+        {
+            std::unique_lock <std::mutex> lock( this->queueLock );
+
+            this->queueDrained.wait( lock, [this] { return ( this->jobQueue.empty() && this->runningJobCount == 0 ); } );
+        }
+
+        this->Shutdown();
+
+        this->RethrowWorkerError();
+    }
+
+private:
+    struct exportedDictionary
+    {
+        inline exportedDictionary( rw::TexDictionary *texDict ) : refCount( 1 )
+        {
+            this->texDict = texDict;
+        }
+
+        rw::TexDictionary *texDict;
+        std::atomic <uint32_t> refCount;
+    };
+
+    struct exportJob
+    {
+        exportedDictionary *dictRef;
+        rw::TextureBase *texHandle;
+        filePath targetFileName;
+    };
+
+    inline filePath GetTargetFileName( rw::TextureBase *texHandle, const filePath& txdFileName, const filePath& relPathFromRoot ) const
+    {
+        // Construct the target filename.
+        filePath targetFileName = relPathFromRoot;
+
+        if ( outputType == MassExportModule::OUTPUT_PLAIN )
+        {
+            // We are a plain path, which is just the texture name appended.
+        }
+        else if ( outputType == MassExportModule::OUTPUT_TXDNAME )
+        {
+            // Also put the TexDictionary name before it.
+            targetFileName += txdFileName;
+            targetFileName += "_";
+        }
+        else if ( outputType == MassExportModule::OUTPUT_FOLDERS )
+        {
+            // Instead put it inside folders.
+            targetFileName += txdFileName;
+            targetFileName += "/";
+        }
+
+        targetFileName += texHandle->GetName();
+        targetFileName += ".";
+
+        targetFileName.append( this->lowerExt.c_str() );
+
+        return targetFileName;
+    }
+
+    inline void ReleaseDictionary( exportedDictionary *dictRef )
+    {
+        if ( dictRef->refCount.fetch_sub( 1 ) == 1 )
+        {
+            this->rwEngine->DeleteRwObject( dictRef->texDict );
+
+            delete dictRef;
+        }
+    }
+
+    inline void RunJob( exportJob& job )
+    {
+        try
+        {
+            WriteTextureImage( this->rwEngine, job.texHandle, this->outputRoot, job.targetFileName, this->imgFormat );
+        }
+        catch( rw::RwException& )
+        {
+            // We ignore RenderWare errors.
+        }
+        catch( ... )
+        {
+            this->ReleaseDictionary( job.dictRef );
+
+            throw;
+        }
+
+        this->ReleaseDictionary( job.dictRef );
+    }
+
+    inline void PushJob( exportJob&& job )
+    {
+        if ( this->workers.empty() )
+        {
+            this->RunJob( job );
+            return;
+        }
+
+        // Do not hand out more work if an encoder has failed.
+        this->RethrowWorkerError();
+
+        {
+            std::unique_lock <std::mutex> lock( this->queueLock );
+
+            // Apply backpressure.
+            this->queueHasSpace.wait( lock, [this] { return ( this->jobQueue.size() < this->maxQueuedJobs ); } );
+
+            this->jobQueue.push_back( std::move( job ) );
+        }
+
+        this->queueHasJobs.notify_one();
+    }
+
+    inline void RethrowWorkerError( void )
+    {
+        std::exception_ptr error;
+        {
+            std::unique_lock <std::mutex> lock( this->queueLock );
+
+            error = std::move( this->workerError );
+
+            this->workerError = nullptr;
+        }
+
+        if ( error )
+        {
+            std::rethrow_exception( error );
+        }
+    }
+
+    // Textures can map to the same file, for example same-named textures of different TXDs
+    // in plain output mode. Such jobs must not be written at the same time, and the last
+    // queued one has to win, just like when exporting sequentially.
+    inline bool IsPathBeingWritten( const filePath& targetFileName ) const
+    {
+        for ( const filePath& busyPath : this->busyPaths )
+        {
+            // Be conservative for case-insensitive file systems.
+            if ( busyPath.equals( targetFileName, false ) )
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    inline std::deque <exportJob>::iterator FindRunnableJob( void )
+    {
+        return std::find_if( this->jobQueue.begin(), this->jobQueue.end(),
+            [this]( const exportJob& job )
+        {
+            return ( this->IsPathBeingWritten( job.targetFileName ) == false );
+        });
+    }
+
+    inline void WorkerMain( void )
+    {
+        while ( true )
+        {
+            exportJob job;
+            {
+                std::unique_lock <std::mutex> lock( this->queueLock );
+
+                std::deque <exportJob>::iterator jobIter;
+
+                this->queueHasJobs.wait( lock, [&] { return ( this->isTerminating || ( jobIter = this->FindRunnableJob() ) != this->jobQueue.end() ); } );
+
+                if ( this->isTerminating )
+                    break;
+
+                job = std::move( *jobIter );
+
+                this->jobQueue.erase( jobIter );
+
+                this->busyPaths.push_back( job.targetFileName );
+
+                this->runningJobCount++;
+            }
+
+            this->queueHasSpace.notify_one();
+
+            try
+            {
+                this->RunJob( job );
+            }
+            catch( ... )
+            {
+                std::unique_lock <std::mutex> lock( this->queueLock );
+
+                if ( !this->workerError )
+                {
+                    this->workerError = std::current_exception();
+                }
+            }
+
+            {
+                std::unique_lock <std::mutex> lock( this->queueLock );
+
+                for ( std::vector <filePath>::iterator iter = this->busyPaths.begin(); iter != this->busyPaths.end(); iter++ )
+                {
+                    if ( *iter == job.targetFileName )
+                    {
+                        this->busyPaths.erase( iter );
+                        break;
+                    }
+                }
 
-                delete targetStream;
+                this->runningJobCount--;
             }
+
+            // Jobs of the same file could be waiting for us.
+            this->queueHasJobs.notify_all();
+            this->queueDrained.notify_all();
         }
     }
-}
+
+    static void _worker_entry( rw::thread_t threadHandle, rw::Interface *rwEngine, void *ud )
+    {
+        imageExportPool *pool = (imageExportPool*)ud;
+
+        // Take over the configuration of the thread that runs the export.
+        try
+        {
+            rw::AssignThreadedRuntimeConfig( rwEngine, pool->threadConfig );
+        }
+        catch( ... )
+        {
+            std::unique_lock <std::mutex> lock( pool->queueLock );
+
+            if ( !pool->workerError )
+            {
+                pool->workerError = std::current_exception();
+            }
+        }
+
+        // Keep serving jobs even if that failed, so that the queue drains.
+        // The reader picks up the error with its next job.
+        pool->WorkerMain();
+
+        rw::ReleaseThreadedRuntimeConfig( rwEngine );
+    }
+
+    inline void Shutdown( void )
+    {
+        {
+            std::unique_lock <std::mutex> lock( this->queueLock );
+
+            this->isTerminating = true;
+        }
+
+        this->queueHasJobs.notify_all();
+
+        for ( rw::thread_t workerThread : this->workers )
+        {
+            rw::JoinThread( this->rwEngine, workerThread );
+            rw::CloseThread( this->rwEngine, workerThread );
+        }
+
+        this->workers.clear();
+
+        // Drop anything that was not written.
+        for ( exportJob& job : this->jobQueue )
+        {
+            this->ReleaseDictionary( job.dictRef );
+        }
+
+        this->jobQueue.clear();
+    }
+
+    rw::Interface *rwEngine;
+    CFileTranslator *outputRoot;
+    MassExportModule::eOutputType outputType;
+    const rw::rwStaticString <char>& imgFormat;
+    std::string lowerExt;
+
+    rw::runtimeConfig_t threadConfig;
+
+    std::vector <rw::thread_t> workers;
+
+    std::mutex queueLock;
+    std::condition_variable queueHasJobs;
+    std::condition_variable queueHasSpace;
+    std::condition_variable queueDrained;
+    std::deque <exportJob> jobQueue;
+    std::vector <filePath> busyPaths;
+    size_t maxQueuedJobs;
+    uint32_t runningJobCount;
+    bool isTerminating;
+    std::exception_ptr workerError;
+};
 
 struct _discFileSentry_txdexport
 {
     MassExportModule *module;
-    const MassExportModule::run_config *config;
+    imageExportPool *exportPool;
 
     inline bool OnSingletonFile(
         CFileTranslator *sourceRoot, CFileTranslator *buildRoot, const filePath& relPathFromRoot,
@@ -192,24 +589,11 @@ struct _discFileSentry_txdexport
 
                 if ( texDict )
                 {
-                    try
-                    {
-                        // Export everything inside of this.
-                        ExportImagesFromDictionary(
-                            texDict, buildRoot, fileName, relPathFromRootWithoutFile, config->outputType,
-                            config->recImgFormat
-                        );
+                    // Export everything inside of this.
+                    // The pool deletes the dictionary once all of its textures have been written.
+                    exportPool->PushDictionary( texDict, fileName, relPathFromRootWithoutFile );
 
-                        anyWork = true;
-                    }
-                    catch( ... )
-                    {
-                        rwEngine->DeleteRwObject( texDict );
-
-                        throw;
-                    }
-
-                    rwEngine->DeleteRwObject( texDict );
+                    anyWork = true;
                 }
             }
         }
@@ -226,6 +610,12 @@ struct _discFileSentry_txdexport
     {
         return;
     }
+
+    inline bool FlushPendingFiles( void )
+    {
+        // We never write into the build root.
+        return false;
+    }
 };
 
 bool MassExportModule::ApplicationMain( const run_config& cfg )
@@ -258,11 +648,19 @@ bool MassExportModule::ApplicationMain( const run_config& cfg )
                 fileProc.setUseCompressedIMGArchives( true );
                 fileProc.setArchiveReconstruction( false );
 
+                // Bulk dumps usually do not need the smallest possible files.
+                this->GetEngine()->SetPNGEncodeProfile( cfg.pngProfile );
+
+                imageExportPool exportPool( this->GetEngine(), outputRootTranslator, cfg.outputType, cfg.recImgFormat );
+
                 _discFileSentry_txdexport sentry;
                 sentry.module = this;
-                sentry.config = &cfg;
+                sentry.exportPool = &exportPool;
 
                 fileProc.process( &sentry, gameRootTranslator, outputRootTranslator );
+
+                // Wait for the encoders to write out the remaining images.
+                exportPool.Finish();
             }
         }
         catch( ... )
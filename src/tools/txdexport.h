@@ -17,6 +17,7 @@ struct MassExportModule abstract : public MessageReceiver
         rw::rwStaticString <wchar_t> outputRoot = L"export_out/";
         rw::rwStaticString <char> recImgFormat = "PNG";
         eOutputType outputType = OUTPUT_TXDNAME;
+        rw::ePNGEncodeProfile pngProfile = rw::PNGENCODE_FAST;
     };
 
     inline MassExportModule( rw::Interface *rwEngine )
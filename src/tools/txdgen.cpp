@@ -10,6 +10,11 @@
 
 #include <sdk/NumericFormat.h>
 
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+
 using namespace rwkind;
 
 
@@ -30,6 +35,7 @@ bool TxdGenModule::ProcessTXDArchive(
     bool improveFiltering,
     bool doCompress, float compressionQuality,
     bool outputDebug, CFileTranslator *debugRoot,
+    TextureConversionCache *convCache,
     const rw::LibraryVersion& gameVersion,
     rw::rwStaticString <char>& errMsg
 ) const
@@ -101,6 +107,37 @@ bool TxdGenModule::ProcessTXDArchive(
 
                         if ( texRaster )
                         {
+                            // Skip all the work if an earlier run did process the same texture the same way.
+                            conversionCacheKey cacheKey;
+
+                            if ( convCache )
+                            {
+                                cacheKey = convCache->MakeKey( theTexture );
+                                cacheKey.AddParam( targetPlatform );
+                                cacheKey.AddParam( targetGame );
+                                cacheKey.AddParam( clearMipmaps );
+                                cacheKey.AddParam( generateMipmaps );
+
+                                if ( generateMipmaps )
+                                {
+                                    cacheKey.AddParam( mipGenMode );
+                                    cacheKey.AddParam( mipGenMaxLevel );
+                                }
+
+                                cacheKey.AddParam( improveFiltering );
+                                cacheKey.AddParam( doCompress );
+
+                                if ( doCompress )
+                                {
+                                    cacheKey.AddParam( compressionQuality );
+                                }
+
+                                if ( convCache->Fetch( theTexture, cacheKey ) )
+                                {
+                                    continue;
+                                }
+                            }
+
                             // Decide whether to convert to target architecture beforehand or afterward.
                             bool shouldConvertBeforehand = ShouldRasterConvertBeforehand( texRaster, targetPlatform );
 
@@ -258,6 +295,11 @@ bool TxdGenModule::ProcessTXDArchive(
                                     hasConvertedToTargetArchitecture = true;
                                 }
                             }
+
+                            if ( convCache )
+                            {
+                                convCache->Store( theTexture, cacheKey );
+                            }
                         }
                     }
                 }
@@ -353,6 +395,472 @@ bool TxdGenModule::ProcessTXDArchive(
     return hasProcessed;
 }
 
+struct _discFileSentry_txdgen;
+
+// Converting a TXD is mostly CPU work, while reading and writing the game files is mostly disk work.
+// The thread that walks the game files reads every TXD into memory and hands it to a pool of
+// converters. The results are committed into the build root in the order of the walk, so that
+// rebuilt IMG archives keep their file order. Only the walking thread touches the translators.
+struct txdConversionPipeline
+{
+    inline txdConversionPipeline( TxdGenModule *module, const _discFileSentry_txdgen *converter )
+    {
+        rw::Interface *rwEngine = module->GetEngine();
+
+        this->module = module;
+        this->rwEngine = rwEngine;
+        this->converter = converter;
+
+        this->threadConfig = nullptr;
+
+        this->hasCommittedWork = false;
+        this->isTerminating = false;
+
+        uint32_t workerCount = rw::GetParallelCapability( rwEngine );
+
+        if ( workerCount <= 1 )
+        {
+            // Convert on the walking thread itself.
+            workerCount = 0;
+        }
+
+        // Bounds the memory that is taken by files that are read ahead or wait for commit.
+        this->maxPendingJobs = ( workerCount * 4 );
+
+        this->workers.reserve( workerCount );
+
+        try
+        {
+            // Workers have to run with the same configuration as we do.
+            if ( workerCount != 0 )
+            {
+                this->threadConfig = rw::CaptureRuntimeConfig( rwEngine );
+            }
+
+            for ( uint32_t n = 0; n < workerCount; n++ )
+            {
+                rw::thread_t workerThread = rw::MakeThread( rwEngine, _worker_entry, this );
+
+                if ( workerThread == nullptr )
+                {
+                    // We simply do with less workers.
+                    break;
+                }
+
+                this->workers.push_back( workerThread );
+
+                rw::ResumeThread( rwEngine, workerThread );
+            }
+        }
+        catch( ... )
+        {
+            this->Shutdown();
+
+            if ( this->threadConfig )
+            {
+                rw::DeleteRuntimeConfig( rwEngine, this->threadConfig );
+            }
+
+            throw;
+        }
+    }
+
+    inline ~txdConversionPipeline( void )
+    {
+        // Pending files are dropped if the conversion was cancelled.
+        this->Shutdown();
+
+        if ( this->threadConfig )
+        {
+            rw::DeleteRuntimeConfig( this->rwEngine, this->threadConfig );
+        }
+    }
+
+    inline bool IsParallel( void ) const
+    {
+        return ( this->workers.empty() == false );
+    }
+
+    inline bool HasPendingJobs( void ) const
+    {
+        return ( this->pendingJobs.empty() == false );
+    }
+
+    // Queues a file for the build root. TXD files are converted, any other file is copied.
+    // The source stream is read into memory right away.
+    inline void Push( CFileTranslator *sourceRoot, CFileTranslator *buildRoot, const filePath& relPathFromRoot, bool isTXD, CFile *sourceStream )
+    {
+        // Do not read any more files if a converter has failed.
+        this->RethrowWorkerError();
+
+        // Make room by committing the oldest files.
+        while ( this->pendingJobs.size() >= this->maxPendingJobs )
+        {
+            this->CommitNextJob();
+        }
+
+        pipelineJob *job = new pipelineJob;
+        job->sourceRoot = sourceRoot;
+        job->buildRoot = buildRoot;
+        job->relPathFromRoot = relPathFromRoot;
+        job->isTXD = isTXD;
+        job->isDone = ( isTXD == false );
+
+        try
+        {
+            job->sourceData = fileSystem->CreateMemoryFile();
+
+            sourceStream->Seek( 0, SEEK_SET );
+
+            FileSystem::StreamCopy( *sourceStream, *job->sourceData );
+
+            job->sourceData->Seek( 0, SEEK_SET );
+
+            if ( isTXD )
+            {
+                job->resultData = fileSystem->CreateMemoryFile();
+            }
+
+            std::unique_lock <std::mutex> lock( this->queueLock );
+
+            this->pendingJobs.push_back( job );
+
+            if ( isTXD )
+            {
+                this->workQueue.push_back( job );
+            }
+        }
+        catch( ... )
+        {
+            DeleteJob( job );
+
+            throw;
+        }
+
+        if ( isTXD )
+        {
+            this->queueHasJobs.notify_one();
+        }
+
+        // Write whatever is ready.
+        this->CommitFinishedJobs( false );
+    }
+
+    // Commits all pending files. Returns whether any file was converted since the last flush.
+    inline bool Flush( void )
+    {
+        this->CommitFinishedJobs( true );
+
+        this->RethrowWorkerError();
+
+        bool anyWork = this->hasCommittedWork;
+
+        this->hasCommittedWork = false;
+
+        return anyWork;
+    }
+
+private:
+    struct pipelineJob
+    {
+        inline pipelineJob( void )
+        {
+            this->sourceData = nullptr;
+            this->resultData = nullptr;
+            this->hasProcessed = false;
+        }
+
+        CFileTranslator *sourceRoot;
+        CFileTranslator *buildRoot;
+        filePath relPathFromRoot;
+        bool isTXD;
+
+        CFile *sourceData;
+        CFile *resultData;
+
+        bool isDone;
+        bool hasProcessed;
+        rw::rwStaticString <char> errMsg;
+        rw::rwStaticString <char> warnings;
+    };
+
+    // Every converter collects the warnings of its current TXD, so that they are put out together with it.
+    struct jobWarningBuffer : public rw::WarningManagerInterface
+    {
+        rw::rwStaticString <char> buffer;
+
+        virtual void OnWarning( rw::rwStaticString <char>&& message ) override
+        {
+            if ( buffer.GetLength() > 0 )
+            {
+                buffer += '\n';
+            }
+
+            buffer += message;
+        }
+    };
+
+    static inline void DeleteJob( pipelineJob *job )
+    {
+        if ( CFile *sourceData = job->sourceData )
+        {
+            delete sourceData;
+        }
+
+        if ( CFile *resultData = job->resultData )
+        {
+            delete resultData;
+        }
+
+        delete job;
+    }
+
+    inline void RunJob( pipelineJob *job, jobWarningBuffer& warningBuf );
+
+    inline void CommitFinishedJobs( bool waitForAll )
+    {
+        while ( this->pendingJobs.empty() == false )
+        {
+            if ( !waitForAll )
+            {
+                std::unique_lock <std::mutex> lock( this->queueLock );
+
+                if ( this->pendingJobs.front()->isDone == false )
+                    break;
+            }
+
+            this->CommitNextJob();
+        }
+    }
+
+    inline void CommitNextJob( void )
+    {
+        pipelineJob *job;
+        {
+            std::unique_lock <std::mutex> lock( this->queueLock );
+
+            this->jobDone.wait( lock, [this] { return ( this->pendingJobs.front()->isDone || this->workerError ); } );
+
+            if ( this->pendingJobs.front()->isDone == false )
+            {
+                lock.unlock();
+
+                // The job will never be finished.
+                this->RethrowWorkerError();
+            }
+
+            job = this->pendingJobs.front();
+
+            this->pendingJobs.pop_front();
+        }
+
+        try
+        {
+            TxdGenModule *module = this->module;
+
+            CFile *targetStream = job->buildRoot->Open( job->relPathFromRoot, L"wb" );
+
+            if ( targetStream )
+            {
+                try
+                {
+                    bool hasCopiedFile = false;
+
+                    if ( job->isTXD )
+                    {
+                        module->OnMessage( "*** " + job->relPathFromRoot.convert_ansi <rw::RwStaticMemAllocator> () + " ..." );
+
+                        if ( job->hasProcessed )
+                        {
+                            job->resultData->Seek( 0, SEEK_SET );
+
+                            FileSystem::StreamCopy( *job->resultData, *targetStream );
+
+                            hasCopiedFile = true;
+
+                            this->hasCommittedWork = true;
+
+                            module->OnMessage( "OK\n" );
+                        }
+                        else
+                        {
+                            module->OnMessage( "error:\n" + job->errMsg + "\n" );
+                        }
+
+                        // Output any warnings.
+                        if ( job->warnings.GetLength() > 0 )
+                        {
+                            module->_warningMan.OnWarning( std::move( job->warnings ) );
+                        }
+
+                        module->_warningMan.Purge();
+                    }
+
+                    if ( !hasCopiedFile )
+                    {
+                        FileSystem::StreamCopy( *job->sourceData, *targetStream );
+                    }
+                }
+                catch( ... )
+                {
+                    delete targetStream;
+
+                    throw;
+                }
+
+                delete targetStream;
+            }
+        }
+        catch( ... )
+        {
+            DeleteJob( job );
+
+            throw;
+        }
+
+        DeleteJob( job );
+    }
+
+    inline void RethrowWorkerError( void )
+    {
+        std::exception_ptr error;
+        {
+            std::unique_lock <std::mutex> lock( this->queueLock );
+
+            error = this->workerError;
+        }
+
+        if ( error )
+        {
+            std::rethrow_exception( error );
+        }
+    }
+
+    inline void WorkerMain( void )
+    {
+        jobWarningBuffer warningBuf;
+
+        this->rwEngine->SetWarningManager( &warningBuf );
+
+        while ( true )
+        {
+            pipelineJob *job;
+            {
+                std::unique_lock <std::mutex> lock( this->queueLock );
+
+                this->queueHasJobs.wait( lock, [this] { return ( this->isTerminating || this->workQueue.empty() == false ); } );
+
+                if ( this->isTerminating )
+                    break;
+
+                job = this->workQueue.front();
+
+                this->workQueue.pop_front();
+            }
+
+            try
+            {
+                this->RunJob( job, warningBuf );
+            }
+            catch( ... )
+            {
+                std::unique_lock <std::mutex> lock( this->queueLock );
+
+                if ( !this->workerError )
+                {
+                    this->workerError = std::current_exception();
+                }
+
+                this->jobDone.notify_all();
+
+                break;
+            }
+
+            {
+                std::unique_lock <std::mutex> lock( this->queueLock );
+
+                job->isDone = true;
+            }
+
+            this->jobDone.notify_all();
+        }
+
+        this->rwEngine->SetWarningManager( nullptr );
+    }
+
+    static void _worker_entry( rw::thread_t threadHandle, rw::Interface *rwEngine, void *ud )
+    {
+        txdConversionPipeline *pipeline = (txdConversionPipeline*)ud;
+
+        try
+        {
+            // Take over the configuration of the thread that runs the conversion.
+            rw::AssignThreadedRuntimeConfig( rwEngine, pipeline->threadConfig );
+
+            pipeline->WorkerMain();
+        }
+        catch( ... )
+        {
+            std::unique_lock <std::mutex> lock( pipeline->queueLock );
+
+            if ( !pipeline->workerError )
+            {
+                pipeline->workerError = std::current_exception();
+            }
+
+            pipeline->jobDone.notify_all();
+        }
+
+        rw::ReleaseThreadedRuntimeConfig( rwEngine );
+    }
+
+    inline void Shutdown( void )
+    {
+        {
+            std::unique_lock <std::mutex> lock( this->queueLock );
+
+            this->isTerminating = true;
+        }
+
+        this->queueHasJobs.notify_all();
+
+        for ( rw::thread_t workerThread : this->workers )
+        {
+            rw::JoinThread( this->rwEngine, workerThread );
+            rw::CloseThread( this->rwEngine, workerThread );
+        }
+
+        this->workers.clear();
+
+        // Drop anything that was not committed.
+        for ( pipelineJob *job : this->pendingJobs )
+        {
+            DeleteJob( job );
+        }
+
+        this->pendingJobs.clear();
+        this->workQueue.clear();
+    }
+
+    TxdGenModule *module;
+    rw::Interface *rwEngine;
+    const _discFileSentry_txdgen *converter;
+
+    rw::runtimeConfig_t threadConfig;
+
+    std::vector <rw::thread_t> workers;
+
+    std::mutex queueLock;
+    std::condition_variable queueHasJobs;
+    std::condition_variable jobDone;
+    std::deque <pipelineJob*> pendingJobs;     // in order of commit
+    std::deque <pipelineJob*> workQueue;       // TXDs that wait for a converter
+    size_t maxPendingJobs;
+    bool hasCommittedWork;
+    bool isTerminating;
+    std::exception_ptr workerError;
+};
+
 struct _discFileSentry_txdgen
 {
     TxdGenModule *module;
@@ -368,6 +876,23 @@ struct _discFileSentry_txdgen
     rw::LibraryVersion gameVersion;
     bool outputDebug;
     CFileTranslator *debugTranslator;
+    TextureConversionCache *convCache;
+    txdConversionPipeline *pipeline;
+
+    inline bool ConvertTXD( CFileTranslator *sourceRoot, CFile *sourceStream, CFile *targetStream, rw::rwStaticString <char>& errMsg ) const
+    {
+        return this->module->ProcessTXDArchive(
+            sourceRoot, sourceStream, targetStream, this->targetPlatform, this->targetGame,
+            this->clearMipmaps,
+            this->generateMipmaps, this->mipGenMode, this->mipGenMaxLevel,
+            this->improveFiltering,
+            this->doCompress, this->compressionQuality,
+            this->outputDebug, this->debugTranslator,
+            this->convCache,
+            this->gameVersion,
+            errMsg
+        );
+    }
 
     inline bool OnSingletonFile(
         CFileTranslator *sourceRoot, CFileTranslator *buildRoot, const filePath& relPathFromRoot,
@@ -388,6 +913,25 @@ struct _discFileSentry_txdgen
             requiresCopy = true;
         }
 
+        if ( requiresCopy && sourceStream )
+        {
+            txdConversionPipeline *pipeline = this->pipeline;
+
+            if ( pipeline != nullptr && pipeline->IsParallel() )
+            {
+                bool isTXD = extention.equals( "TXD", false );
+
+                // Other files have to wait behind the TXDs that are in work, to keep the file order.
+                if ( isTXD || pipeline->HasPendingJobs() )
+                {
+                    pipeline->Push( sourceRoot, buildRoot, relPathFromRoot, isTXD, sourceStream );
+
+                    // The pipeline reports the work when it is flushed.
+                    return false;
+                }
+            }
+        }
+
         // Open the target stream.
         CFile *targetStream = NULL;
 
@@ -407,16 +951,7 @@ struct _discFileSentry_txdgen
 
                     rw::rwStaticString <char> errorMessage;
 
-                    bool couldProcessTXD = this->module->ProcessTXDArchive(
-                        sourceRoot, sourceStream, targetStream, this->targetPlatform, this->targetGame,
-                        this->clearMipmaps,
-                        this->generateMipmaps, this->mipGenMode, this->mipGenMaxLevel,
-                        this->improveFiltering,
-                        this->doCompress, this->compressionQuality,
-                        this->outputDebug, this->debugTranslator,
-                        this->gameVersion,
-                        errorMessage
-                    );
+                    bool couldProcessTXD = this->ConvertTXD( sourceRoot, sourceStream, targetStream, errorMessage );
 
                     if ( couldProcessTXD )
                     {
@@ -464,8 +999,27 @@ struct _discFileSentry_txdgen
     {
         module->OnMessage( "failed to create new IMG archive for processing; defaulting to file-copy ...\n" );
     }
+
+    inline bool FlushPendingFiles( void )
+    {
+        if ( txdConversionPipeline *pipeline = this->pipeline )
+        {
+            return pipeline->Flush();
+        }
+
+        return false;
+    }
 };
 
+inline void txdConversionPipeline::RunJob( pipelineJob *job, jobWarningBuffer& warningBuf )
+{
+    warningBuf.buffer.Clear();
+
+    job->hasProcessed = this->converter->ConvertTXD( job->sourceRoot, job->sourceData, job->resultData, job->errMsg );
+
+    job->warnings = std::move( warningBuf.buffer );
+}
+
 inline bool isGoodEngine( const rw::Interface *engineInterface )
 {
     if ( engineInterface->IsObjectRegistered( "texture" ) == false )
@@ -651,6 +1205,11 @@ TxdGenModule::run_config TxdGenModule::ParseConfig( CFileTranslator *root, const
                     cfg.c_imgArchivesCompressed = mainEntry->GetBool( "imgArchivesCompressed" );
                 }
 
+                if ( mainEntry->Find( "imgArchivesFastCompression" ) )
+                {
+                    cfg.c_imgArchivesFastCompression = mainEntry->GetBool( "imgArchivesFastCompression" );
+                }
+
                 // Serialization compatibility setting.
                 if ( mainEntry->Find( "ignoreSerializationRegions" ) )
                 {
@@ -662,6 +1221,23 @@ TxdGenModule::run_config TxdGenModule::ParseConfig( CFileTranslator *root, const
                 {
                     cfg.c_outputDebug = mainEntry->GetBool( "outputDebug" );
                 }
+
+                // Conversion cache directory.
+                if ( const char *newConversionCacheRoot = mainEntry->Get( "conversionCache" ) )
+                {
+                    cfg.c_conversionCacheRoot = CharacterUtil::ConvertStrings <char8_t, wchar_t, rw::RwStaticMemAllocator> ( (const char8_t*)newConversionCacheRoot );
+                }
+
+                // Conversion cache size limit, in megabytes.
+                if ( mainEntry->Find( "conversionCacheMaxSize" ) )
+                {
+                    int cacheMaxSizeInt = mainEntry->GetInt( "conversionCacheMaxSize" );
+
+                    if ( cacheMaxSizeInt >= 0 )
+                    {
+                        cfg.c_conversionCacheMaxSizeMB = (unsigned int)cacheMaxSizeInt;
+                    }
+                }
             }
 
             // Kill the configuration.
@@ -888,10 +1464,25 @@ bool TxdGenModule::ApplicationMain( const run_config& cfg )
             rw::rwStaticString <char> ( "* imgArchivesCompressed: " ) + ( cfg.c_imgArchivesCompressed ? "true" : "false" ) + "\n"
         );
 
+        this->OnMessage(
+            rw::rwStaticString <char> ( "* imgArchivesFastCompression: " ) + ( cfg.c_imgArchivesFastCompression ? "true" : "false" ) + "\n"
+        );
+
         this->OnMessage(
             rw::rwStaticString <char> ( "* ignoreSerializationRegions: " ) + ( rwEngine->GetIgnoreSerializationBlockRegions() ? "true" : "false" ) + "\n"
         );
 
+        this->OnMessage(
+            L"* conversionCache: " + ( cfg.c_conversionCacheRoot.IsEmpty() ? rw::rwStaticString <wchar_t> ( L"disabled" ) : cfg.c_conversionCacheRoot ) + L"\n"
+        );
+
+        if ( cfg.c_conversionCacheRoot.IsEmpty() == false )
+        {
+            this->OnMessage(
+                "* conversionCacheMaxSize: " + eir::to_string <char, rw::RwStaticMemAllocator> ( cfg.c_conversionCacheMaxSizeMB ) + "MB\n"
+            );
+        }
+
         // Finish with a newline.
         this->OnMessage( "\n" );
 
@@ -913,8 +1504,27 @@ bool TxdGenModule::ApplicationMain( const run_config& cfg )
                 hasDebugRoot = obtainAbsolutePath( L"debug_output/", absDebugOutputTranslator, true, true );
             }
 
+            // Debug output needs the intermediate rasters, so it cannot use cached results.
+            TextureConversionCache convCache( rwEngine );
+
+            bool hasConvCache = false;
+
+            if ( cfg.c_conversionCacheRoot.IsEmpty() == false && cfg.c_outputDebug == false )
+            {
+                hasConvCache = convCache.Open( cfg.c_conversionCacheRoot.GetConstString() );
+
+                if ( !hasConvCache )
+                {
+                    this->OnMessage( "could not open the conversion cache; processing all textures\n\n" );
+                }
+            }
+
             if ( hasGameRoot && hasOutputRoot )
             {
+                eLZOCompressionLevel prevLZOLevel = fileSystem->GetLZOCompressionLevel();
+
+                fileSystem->SetLZOCompressionLevel( cfg.c_imgArchivesFastCompression ? eLZOCompressionLevel::FAST : eLZOCompressionLevel::BEST );
+
                 try
                 {
                     // Check for build root conflicts.
@@ -945,8 +1555,22 @@ bool TxdGenModule::ApplicationMain( const run_config& cfg )
                     sentry.gameVersion = targetVersion;
                     sentry.outputDebug = cfg.c_outputDebug;
                     sentry.debugTranslator = absDebugOutputTranslator;
+                    sentry.convCache = ( hasConvCache ? &convCache : nullptr );
+                    sentry.pipeline = nullptr;
+
+                    // Debug output needs the source paths, so it runs one TXD after another.
+                    if ( cfg.c_outputDebug )
+                    {
+                        fileProc.process( &sentry, absGameRootTranslator, absOutputRootTranslator );
+                    }
+                    else
+                    {
+                        txdConversionPipeline pipeline( this, &sentry );
+
+                        sentry.pipeline = &pipeline;
 
-                    fileProc.process( &sentry, absGameRootTranslator, absOutputRootTranslator );
+                        fileProc.process( &sentry, absGameRootTranslator, absOutputRootTranslator );
+                    }
 
                     // Output any warnings.
                     _warningMan.Purge();
@@ -960,6 +1584,8 @@ bool TxdGenModule::ApplicationMain( const run_config& cfg )
 
                     successful = false;
                 }
+
+                fileSystem->SetLZOCompressionLevel( prevLZOLevel );
             }
             else
             {
@@ -974,6 +1600,11 @@ bool TxdGenModule::ApplicationMain( const run_config& cfg )
                 }
             }
 
+            if ( hasConvCache )
+            {
+                convCache.Prune( (rw::uint64)cfg.c_conversionCacheMaxSizeMB * 1024 * 1024 );
+            }
+
             // Clean up resources.
             if ( hasDebugRoot )
             {
@@ -3,6 +3,8 @@
 
 #include "shared.h"
 
+#include "texconvcache.h"
+
 class TxdGenModule : public MessageReceiver
 {
 public:
@@ -45,12 +47,21 @@ public:
 
         bool c_imgArchivesCompressed = false;
 
+        // Quick LZO compression of IMG archives for test builds; release builds want the smallest files.
+        bool c_imgArchivesFastCompression = false;
+
         bool c_ignoreSerializationRegions = true;
 
         float c_compressionQuality = 1.0f;
 
         bool c_outputDebug = false;
 
+        // Results of texture processing are kept here for the next run; empty to disable.
+        rw::rwStaticString <wchar_t> c_conversionCacheRoot;
+
+        // Oldest cache entries are deleted after the run so that the cache stays below this size.
+        unsigned int c_conversionCacheMaxSizeMB = 1024;
+
         int c_warningLevel = 3;
 
         bool c_ignoreSecureWarnings = false;
@@ -67,6 +78,7 @@ public:
         bool improveFiltering,
         bool doCompress, float compressionQuality,
         bool outputDebug, CFileTranslator *debugRoot,
+        TextureConversionCache *convCache,
         const rw::LibraryVersion& gameVersion,
         rw::rwStaticString <char>& errMsg
     ) const;